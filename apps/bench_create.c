@@ -0,0 +1,73 @@
+/*
+ * Thread creation benchmark
+ *
+ * A thread creates a fixed number of threads (100000 by default) that return
+ * right away, yielding after each batch of 64 so that they run and exit, and
+ * their stacks go back to the pool. The average cost of creating, running and
+ * reclaiming a thread is reported, as a single line of key=value pairs.
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <uthread.h>
+
+#define NR_THREADS	100000
+#define BATCH		64
+
+static unsigned int nr_threads = NR_THREADS;
+static unsigned int exited;
+static struct timespec start, stop;
+
+static void empty(void *arg)
+{
+	(void)arg;
+
+	exited++;
+}
+
+static void creator(void *arg)
+{
+	unsigned int i;
+	(void)arg;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < nr_threads; i++) {
+		uthread_create(empty, NULL);
+		if (i % BATCH == BATCH - 1)
+			uthread_yield();
+	}
+	while (exited < nr_threads)
+		uthread_yield();
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	double ns;
+
+	if (argc > 1)
+		nr_threads = get_argv(argv[1]);
+
+	uthread_run(false, creator, NULL);
+
+	ns = (stop.tv_sec - start.tv_sec) * 1e9 + (stop.tv_nsec - start.tv_nsec);
+	printf("bench=create backend=%s unit=thread ops=%u ns/op=%.1f ops/sec=%.0f\n",
+	       uthread_ctx_backend(), exited, exited ? ns / exited : 0.0,
+	       ns > 0 ? exited * 1e9 / ns : 0.0);
+
+	return exited != nr_threads;
+}
@@ -0,0 +1,65 @@
+/*
+ * Queue benchmark
+ *
+ * A queue is kept at a steady length (64 by default) while items go through
+ * it: each operation dequeues the oldest item and enqueues it back, for a fixed
+ * number of operations (1000000 by default). The average cost of an
+ * enqueue/dequeue pair is reported, as a single line of key=value pairs.
+ */
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <queue.h>
+#include <uthread.h>
+
+#define NR_OPS		1000000
+#define LENGTH		64
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nr_ops = NR_OPS, length = LENGTH, i;
+	struct timespec start, stop;
+	queue_t queue;
+	void *data;
+	double ns;
+
+	if (argc > 1)
+		nr_ops = get_argv(argv[1]);
+	if (argc > 2)
+		length = get_argv(argv[2]);
+
+	queue = queue_create();
+	for (i = 0; i < length; i++)
+		queue_enqueue(queue, (void *)(uintptr_t)(i + 1));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < nr_ops; i++) {
+		queue_dequeue(queue, &data);
+		queue_enqueue(queue, data);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	while (queue_dequeue(queue, &data) == 0);
+	queue_destroy(queue);
+
+	ns = (stop.tv_sec - start.tv_sec) * 1e9 + (stop.tv_nsec - start.tv_nsec);
+	printf("bench=queue backend=%s unit=dequeue_enqueue length=%u ops=%u ns/op=%.1f ops/sec=%.0f\n",
+	       uthread_ctx_backend(), length, nr_ops, nr_ops ? ns / nr_ops : 0.0, ns > 0 ? nr_ops * 1e9 / ns : 0.0);
+
+	return 0;
+}
@@ -0,0 +1,126 @@
+/*
+ * Context switch latency benchmark
+ *
+ * Two threads yield back and forth for a fixed number of rounds (100000 by
+ * default) and the average cost of a round trip (two context switches) is
+ * reported, along with the context switch backend the library was built with.
+ * Rebuild with `make clean && make CTX=ucontext` to measure the swapcontext()
+ * backend.
+ *
+ * With a second argument of `sem` or `handoff`, the threads ping-pong through
+ * two semaphores instead, in the default or handoff wake-up mode.
+ *
+ * Like the other benchmarks run by `make bench`, it prints a single line of
+ * space-separated key=value pairs, starting with the name of the benchmark.
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define ROUNDS 100000
+
+static unsigned int rounds = ROUNDS;
+static unsigned long round_trips;
+static struct timespec start, stop;
+static sem_t ping_sem, pong_sem;
+
+static void pong(void *arg)
+{
+	unsigned int i;
+	(void)arg;
+
+	for (i = 0; i < rounds; i++)
+		uthread_yield();
+}
+
+static void sem_pong(void *arg)
+{
+	unsigned int i;
+	(void)arg;
+
+	for (i = 0; i < rounds; i++) {
+		sem_down(pong_sem);
+		sem_up(ping_sem);
+	}
+}
+
+static void sem_ping(void *arg)
+{
+	unsigned int i;
+	(void)arg;
+
+	uthread_create(sem_pong, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < rounds; i++) {
+		round_trips++;
+		sem_up(pong_sem);
+		sem_down(ping_sem);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+}
+
+static void ping(void *arg)
+{
+	unsigned int i;
+	(void)arg;
+
+	uthread_create(pong, NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < rounds; i++) {
+		round_trips++;
+		uthread_yield();
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	const char *mode = "yield";
+	double ns;
+
+	if (argc > 1)
+		rounds = get_argv(argv[1]);
+	if (argc > 2)
+		mode = argv[2];
+
+	if (!strcmp(mode, "yield")) {
+		uthread_run(false, ping, NULL);
+	} else if (!strcmp(mode, "sem") || !strcmp(mode, "handoff")) {
+		ping_sem = sem_create(0);
+		pong_sem = sem_create(0);
+		sem_set_handoff(ping_sem, !strcmp(mode, "handoff"));
+		sem_set_handoff(pong_sem, !strcmp(mode, "handoff"));
+		uthread_run(false, sem_ping, NULL);
+		sem_destroy(ping_sem);
+		sem_destroy(pong_sem);
+	} else {
+		fprintf(stderr, "Unknown mode %s\n", mode);
+		return 1;
+	}
+
+	ns = (stop.tv_sec - start.tv_sec) * 1e9 + (stop.tv_nsec - start.tv_nsec);
+	printf("bench=%s backend=%s unit=round_trip ops=%lu ns/op=%.1f ops/sec=%.0f\n",
+	       mode, uthread_ctx_backend(), round_trips, round_trips ? ns / round_trips : 0.0,
+	       ns > 0 ? round_trips * 1e9 / ns : 0.0);
+
+	return 0;
+}
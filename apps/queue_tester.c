@@ -132,11 +132,135 @@ void test_queue_delete(void)
 	queue_dequeue(q, (void**)&ptr);
 }
 
+void test_queue_shrink(void)
+{
+	int dataset[1000];
+	int *ptr;
+	queue_t q;
+	int i, ordered = 1;
+
+	fprintf(stderr, "*** TEST queue_shrink ***\n");
+
+	q = queue_create();
+
+	// Spans several node chunks
+	for (i = 0; i < 1000; i++) {
+		dataset[i] = i;
+		queue_enqueue(q, &dataset[i]);
+	}
+	TEST_ASSERT(queue_length(q) == 1000);
+
+	// Keep a few items queued while shrinking
+	for (i = 0; i < 990; i++) {
+		queue_dequeue(q, (void**)&ptr);
+		if (*ptr != i)
+			ordered = 0;
+	}
+	TEST_ASSERT(ordered);
+	TEST_ASSERT(queue_shrink(q) == 0);
+	TEST_ASSERT(queue_length(q) == 10);
+
+	// Remaining items survive shrinking, and nodes can be allocated again
+	for (i = 0; i < 500; i++)
+		queue_enqueue(q, &dataset[i]);
+	TEST_ASSERT(queue_dequeue(q, (void**)&ptr) == 0 && *ptr == 990);
+	TEST_ASSERT(queue_length(q) == 509);
+
+	while (queue_dequeue(q, (void**)&ptr) == 0)
+		;
+	TEST_ASSERT(queue_shrink(q) == 0);
+	TEST_ASSERT(queue_shrink(NULL) == -1);
+	TEST_ASSERT(queue_destroy(q) == 0);
+}
+
+void test_queue_bounded(void)
+{
+	int data[] = {1, 2, 3, 4, 5, 42, 6, 7, 8, 9};
+	int *ptr;
+	queue_t q;
+	size_t i;
+
+	fprintf(stderr, "*** TEST queue_bounded ***\n");
+
+	TEST_ASSERT(queue_create_bounded(0) == NULL);
+
+	// Capacity is rounded up to 8
+	q = queue_create_bounded(5);
+	TEST_ASSERT(q != NULL);
+	for (i = 0; i < 8; i++)
+		TEST_ASSERT(queue_enqueue(q, &data[i]) == 0);
+	TEST_ASSERT(queue_enqueue(q, &data[8]) == -1);
+	TEST_ASSERT(queue_length(q) == 8);
+
+	// Wrap around the end of the ring
+	TEST_ASSERT(queue_dequeue(q, (void**)&ptr) == 0 && ptr == &data[0]);
+	TEST_ASSERT(queue_dequeue(q, (void**)&ptr) == 0 && ptr == &data[1]);
+	TEST_ASSERT(queue_enqueue(q, &data[8]) == 0);
+	TEST_ASSERT(queue_enqueue(q, &data[9]) == 0);
+
+	// Delete and iterate, deleting item '42' along the way
+	TEST_ASSERT(queue_delete(q, &data[3]) == 0);
+	TEST_ASSERT(queue_delete(q, &data[3]) == -1);
+	queue_iterate(q, iterator_inc);
+	TEST_ASSERT(queue_length(q) == 6);
+	TEST_ASSERT(data[2] == 4);
+	TEST_ASSERT(data[9] == 10);
+
+	// Remaining items come out in order
+	TEST_ASSERT(queue_dequeue(q, (void**)&ptr) == 0 && ptr == &data[2]);
+	TEST_ASSERT(queue_dequeue(q, (void**)&ptr) == 0 && ptr == &data[4]);
+	TEST_ASSERT(queue_dequeue(q, (void**)&ptr) == 0 && ptr == &data[6]);
+	TEST_ASSERT(queue_destroy(q) == -1);
+	while (queue_dequeue(q, (void**)&ptr) == 0)
+		;
+	TEST_ASSERT(ptr == &data[9]);
+	TEST_ASSERT(queue_destroy(q) == 0);
+}
+
+void test_queue_handle(void)
+{
+	int dataset[] = {1, 2, 3, 4, 5};
+	queue_handle_t handles[5];
+	int *ptr;
+	queue_t q;
+	int i;
+
+	fprintf(stderr, "*** TEST queue_handle ***\n");
+
+	q = queue_create();
+	for (i = 0; i < 5; i++)
+		TEST_ASSERT(queue_enqueue_handle(q, &dataset[i], &handles[i]) == 0);
+
+	// Delete middle, first and last items through their handles
+	TEST_ASSERT(queue_delete_handle(q, handles[2]) == 0);
+	TEST_ASSERT(queue_delete_handle(q, handles[0]) == 0);
+	TEST_ASSERT(queue_delete_handle(q, handles[4]) == 0);
+	TEST_ASSERT(queue_length(q) == 2);
+
+	// Mix with regular operations
+	TEST_ASSERT(queue_enqueue(q, &dataset[0]) == 0);
+	TEST_ASSERT(queue_delete(q, &dataset[3]) == 0);
+	TEST_ASSERT(queue_dequeue(q, (void**)&ptr) == 0 && ptr == &dataset[1]);
+	TEST_ASSERT(queue_dequeue(q, (void**)&ptr) == 0 && ptr == &dataset[0]);
+	TEST_ASSERT(queue_length(q) == 0);
+
+	// NULL parameters and bounded queues
+	TEST_ASSERT(queue_delete_handle(q, NULL) == -1);
+	TEST_ASSERT(queue_enqueue_handle(NULL, &dataset[0], NULL) == -1);
+	TEST_ASSERT(queue_destroy(q) == 0);
+	q = queue_create_bounded(4);
+	TEST_ASSERT(queue_enqueue_handle(q, &dataset[0], &handles[0]) == -1);
+	TEST_ASSERT(queue_destroy(q) == 0);
+}
+
 int main(void) {
     test_create();
     test_queue_iterator();
     test_queue_simple();
 	test_queue_destroy();
 	test_queue_delete();
+	test_queue_shrink();
+	test_queue_bounded();
+	test_queue_handle();
     return 0;
 }
\ No newline at end of file
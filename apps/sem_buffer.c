@@ -3,13 +3,16 @@
  *
  * A producer produces N values in a shared buffer, while a consume consumes M
  * of these values. N and M are always less than the size of the buffer but can
- * be different. The synchronization is managed through two semaphores.
+ * be different. The synchronization is managed through two semaphores, and a
+ * mutex protects the size of the buffer. The producer reserves room for its N
+ * values, and publishes them, in one semaphore operation each.
  */
 
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <mutex.h>
 #include <sem.h>
 #include <uthread.h>
 
@@ -19,7 +22,7 @@
 struct test4 {
 	sem_t empty;
 	sem_t full;
-	sem_t mutex;
+	uthread_mutex_t mutex;
 	size_t size, head, tail, maxcount;
 	unsigned int prod_seed, cons_seed;
 	unsigned int buffer[BUFFER_SIZE];
@@ -42,9 +45,9 @@ static void consumer(void* arg)
 			out = t->buffer[t->tail];
 			printf("Consumer is taking %zu out of buffer\n", out);
 			t->tail = (t->tail + 1) % BUFFER_SIZE;
-			sem_down(t->mutex);
+			uthread_mutex_lock(t->mutex);
 			t->size--;
-			sem_up(t->mutex);
+			uthread_mutex_unlock(t->mutex);
 			sem_up(t->full);
 		}
 	}
@@ -62,16 +65,16 @@ static void producer(void* arg)
 		N = clamp(N, t->maxcount - count);
 
 		printf("Producer wants to put %zu items into buffer...\n", N);
+		sem_down_n(t->full, N);
 		for (i = 0; i < N; i++) {
-			sem_down(t->full);
 			printf("Producer is putting %zu into buffer\n", count);
 			t->buffer[t->head] = count++;
 			t->head = (t->head + 1) % BUFFER_SIZE;
-			sem_down(t->mutex);
-			t->size++;
-			sem_up(t->mutex);
-			sem_up(t->empty);
 		}
+		uthread_mutex_lock(t->mutex);
+		t->size += N;
+		uthread_mutex_unlock(t->mutex);
+		sem_up_n(t->empty, N);
 	}
 }
 
@@ -103,7 +106,7 @@ int main(int argc, char **argv)
 	t.size = t.head = t.tail = 0;
 	t.maxcount = maxcount;
 
-	t.mutex = sem_create(1);
+	t.mutex = uthread_mutex_create();
 	t.empty = sem_create(0);
 	t.full = sem_create(BUFFER_SIZE);
 
@@ -111,7 +114,7 @@ int main(int argc, char **argv)
 
 	sem_destroy(t.empty);
 	sem_destroy(t.full);
-	sem_destroy(t.mutex);
+	uthread_mutex_destroy(t.mutex);
 
 	return 0;
 }
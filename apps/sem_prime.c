@@ -5,7 +5,8 @@
  * a consumer thread (sink) gets prime numbers from the end of the pipeline. The
  * pipeline consists of filtering thread, added dynamically each time a new
  * prime number is found and which filters out subsequent numbers that are
- * multiples of that prime.
+ * multiples of that prime. Threads pass numbers along through unbuffered
+ * channels, which are closed to mark the end of the stream.
  */
 
 #include <limits.h>
@@ -13,22 +14,15 @@
 #include <stdlib.h>
 #include <unistd.h>
 
-#include <sem.h>
+#include <chan.h>
 #include <uthread.h>
 
 #define MAXPRIME 1000
 
-struct channel {
-	int value;
-	sem_t produce;
-	sem_t consume;
-};
-
 struct filter {
-	struct channel *left;
-	struct channel *right;
-	unsigned int prime;
-	struct filter *next;
+	uthread_chan_t left;
+	uthread_chan_t right;
+	int prime;
 };
 
 static unsigned int max = MAXPRIME;
@@ -36,19 +30,14 @@ static unsigned int max = MAXPRIME;
 /* Producer thread: produces all numbers, from 2 to max */
 static void source(void *arg)
 {
-	struct channel *c = (struct channel*) arg;
-	size_t i;
+	uthread_chan_t c = arg;
+	int i;
 
-	for (i = 2; i <= max; i++) {
-		c->value = i;
-		sem_up(c->consume);
-		sem_down(c->produce);
-	}
+	for (i = 2; i <= (int)max; i++)
+		uthread_chan_send(c, &i);
 
-	/* mark completion */
-	c->value = -1;
-	sem_up(c->consume);
-	sem_down(c->produce);
+	/* mark completion, the receiver destroys @c once it sees it */
+	uthread_chan_close(c);
 }
 
 /* Filter thread */
@@ -57,74 +46,45 @@ static void filter(void *arg)
 	struct filter *f = (struct filter*) arg;
 	int value;
 
-	while (1) {
-		sem_down(f->left->consume);
-		value = f->left->value;
-		sem_up(f->left->produce);
-		if ((value == -1) || (value % f->prime != 0)) {
-			f->right->value = value;
-			sem_up(f->right->consume);
-			sem_down(f->right->produce);
-		}
-		if (value == -1)
-			break;
+	while (uthread_chan_recv(f->left, &value) == 0) {
+		if (value % f->prime != 0)
+			uthread_chan_send(f->right, &value);
 	}
 
-	sem_destroy(f->left->produce);
-	sem_destroy(f->left->consume);
-	free(f->left);
+	/* Forward completion, the right channel is destroyed downstream */
+	uthread_chan_close(f->right);
+
+	uthread_chan_destroy(f->left);
 	free(f);
 }
 
 /* Consumer thread */
 static void sink(void *arg)
 {
-	struct channel *init_p, *p;
+	uthread_chan_t p;
 	int value;
-	struct filter *f_head = NULL;
 	(void)arg;
 
-	init_p = malloc(sizeof(*init_p));
-
-	p = init_p;
-	p->produce = sem_create(0);
-	p->consume = sem_create(0);
+	p = uthread_chan_create(sizeof(int), 0);
 
 	uthread_create(source, p);
 
-	while (1) {
+	while (uthread_chan_recv(p, &value) == 0) {
 		struct filter *f;
 
-		sem_down(p->consume);
-		value = p->value;
-		sem_up(p->produce);
-
-		if (value == -1)
-			break;
-
 		printf("%d is prime.\n", value);
 
 		f = malloc(sizeof(*f));
 		f->left = p;
 		f->prime = value;
-		f->next = NULL;
-
-		p = malloc(sizeof(*p));
-		p->produce = sem_create(0);
-		p->consume = sem_create(0);
 
+		p = uthread_chan_create(sizeof(int), 0);
 		f->right = p;
 
 		uthread_create(filter, f);
-
-		if (f_head)
-			f->next = f_head;
-		f_head = f;
 	}
 
-	sem_destroy(p->produce);
-	sem_destroy(p->consume);
-	free(p);
+	uthread_chan_destroy(p);
 }
 
 static unsigned int get_argv(char *argv)
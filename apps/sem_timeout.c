@@ -0,0 +1,103 @@
+/*
+ * Semaphore timeout test
+ *
+ * Check sem_trydown() on an available and an unavailable semaphore, then a
+ * sem_timeddown() that expires and one that is satisfied in time. Finally, a
+ * number of client threads (8 by default) compete for a semaphore of 2 slots,
+ * each holding its slot for 50 ms; those that cannot get a slot within 5 ms
+ * give up instead of queuing. The program should output:
+ *
+ * trydown: 0 -1
+ * timeddown expired: -1 after >= 10 ms, semaphore destroyed: 0
+ * timeddown satisfied: 0
+ * served = 2, shed = 6
+ */
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define NR_CLIENTS	8
+#define NR_SLOTS	2
+#define MS		1000000ull
+
+static unsigned int nr_clients = NR_CLIENTS;
+static sem_t slots, ready;
+static unsigned int served, shed;
+
+static void client(void *arg)
+{
+	(void)arg;
+
+	if (sem_timeddown(slots, 5 * MS) < 0) {
+		shed++;
+		return;
+	}
+	served++;
+	uthread_sleep_ns(50 * MS);
+	sem_up(slots);
+}
+
+static void waker(void *arg)
+{
+	(void)arg;
+
+	sem_up(ready);
+}
+
+static void thread1(void *arg)
+{
+	uint64_t start;
+	sem_t sem;
+	int ret1, ret2;
+	unsigned int i;
+	(void)arg;
+
+	sem = sem_create(1);
+	ret1 = sem_trydown(sem);
+	ret2 = sem_trydown(sem);
+	printf("trydown: %d %d\n", ret1, ret2);
+
+	start = uthread_clock_ns();
+	ret1 = sem_timeddown(sem, 10 * MS);
+	printf("timeddown expired: %d after %s 10 ms, semaphore destroyed: %d\n",
+	       ret1, uthread_clock_ns() - start >= 10 * MS ? ">=" : "<",
+	       sem_destroy(sem));
+
+	ready = sem_create(0);
+	uthread_create(waker, NULL);
+	printf("timeddown satisfied: %d\n", sem_timeddown(ready, 1000 * MS));
+	sem_destroy(ready);
+
+	slots = sem_create(NR_SLOTS);
+	for (i = 0; i < nr_clients; i++)
+		uthread_create(client, NULL);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		nr_clients = get_argv(argv[1]);
+
+	uthread_run(false, thread1, NULL);
+
+	printf("served = %u, shed = %u\n", served, shed);
+	sem_destroy(slots);
+
+	return 0;
+}
@@ -0,0 +1,116 @@
+/*
+ * Thread attributes test
+ *
+ * Thread1 creates a named thread with a 1 MiB stack, which recurses far deeper
+ * than the default stack allows. It then creates a normal thread followed by a
+ * high-priority one, which runs first nonetheless. Finally, it creates a
+ * number of tiny threads (1000 by default), each with a stack of a single page,
+ * and waits for all of those it could create. The program should output:
+ *
+ * deep: recursed 4096 levels
+ * urgent: runs first
+ * normal: runs second
+ * tiny: 1000 threads done
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define NR_TINY		1000
+#define DEPTH		4096
+#define FRAME_SIZE	128
+
+static unsigned int nr_tiny = NR_TINY;
+static sem_t done;
+static unsigned int tiny_count;
+
+static unsigned int recurse(unsigned int depth)
+{
+	volatile char frame[FRAME_SIZE];
+
+	memset((char *)frame, depth, sizeof(frame));
+	if (depth == 0)
+		return 0;
+	// Reading the frame after the call keeps the recursion from becoming a loop
+	return recurse(depth - 1) + 1 + (frame[0] != (char)depth);
+}
+
+static void *deep(void *arg)
+{
+	(void)arg;
+
+	printf("%s: recursed %u levels\n", uthread_name(NULL), recurse(DEPTH));
+	return NULL;
+}
+
+static void *say(void *arg)
+{
+	printf("%s: runs %s\n", uthread_name(NULL), (char *)arg);
+	return NULL;
+}
+
+static void *tiny(void *arg)
+{
+	(void)arg;
+
+	tiny_count++;
+	sem_up(done);
+	return NULL;
+}
+
+static void thread1(void *arg)
+{
+	struct uthread_attr attr;
+	uthread_t tid;
+	unsigned int i;
+	(void)arg;
+
+	uthread_attr_init(&attr);
+	attr.stack_size = 1024 * 1024;
+	attr.name = "deep";
+	uthread_create_attr(&tid, &attr, deep, NULL);
+	uthread_join(tid, NULL);
+
+	uthread_attr_init(&attr);
+	attr.name = "normal";
+	uthread_create_attr(NULL, &attr, say, "second");
+	attr.name = "urgent";
+	attr.priority = UTHREAD_PRIO_HIGH;
+	uthread_create_attr(NULL, &attr, say, "first");
+	uthread_yield();
+
+	uthread_attr_init(&attr);
+	attr.stack_size = 4096;
+	done = sem_create(0);
+	for (i = 0; i < nr_tiny; i++) {
+		if (uthread_create_attr(NULL, &attr, tiny, NULL) < 0)
+			break;
+	}
+	sem_down_n(done, i);
+	sem_destroy(done);
+	printf("tiny: %u threads done\n", tiny_count);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		nr_tiny = get_argv(argv[1]);
+
+	return uthread_run(false, thread1, NULL);
+}
@@ -0,0 +1,112 @@
+/*
+ * Channel test
+ *
+ * A number of producer threads (8 by default) send numbers on a buffered
+ * channel, from which as many consumer threads receive them, all running on
+ * several workers (4 by default). Consumers forward each number, squared, on
+ * an unbuffered channel to a single collector thread. Once all the producers
+ * are done, the last one closes the buffered channel, which makes the
+ * consumers stop; the last consumer to stop closes the unbuffered one. The
+ * program should output:
+ *
+ * received = 8000 (expected 8000), sum = 2670668000 (expected 2670668000)
+ */
+
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chan.h>
+#include <uthread.h>
+
+#define NR_PRODUCERS	8
+#define NR_WORKERS	4
+#define COUNT		1000
+#define CAPACITY	16
+
+static unsigned int nr_producers = NR_PRODUCERS;
+static uthread_chan_t numbers, squares;
+static atomic_uint producing, consuming;
+static unsigned long received, sum;
+
+static void producer(void *arg)
+{
+	unsigned long i;
+	(void)arg;
+
+	for (i = 1; i <= COUNT; i++)
+		uthread_chan_send(numbers, &i);
+
+	if (--producing == 0)
+		uthread_chan_close(numbers);
+}
+
+static void consumer(void *arg)
+{
+	unsigned long n;
+	(void)arg;
+
+	while (uthread_chan_recv(numbers, &n) == 0) {
+		n *= n;
+		uthread_chan_send(squares, &n);
+	}
+
+	if (--consuming == 0)
+		uthread_chan_close(squares);
+}
+
+static void collector(void *arg)
+{
+	unsigned long n;
+	unsigned int i;
+	(void)arg;
+
+	producing = consuming = nr_producers;
+	for (i = 0; i < nr_producers; i++) {
+		uthread_create(producer, NULL);
+		uthread_create(consumer, NULL);
+	}
+
+	while (uthread_chan_recv(squares, &n) == 0) {
+		received++;
+		sum += n;
+	}
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nr_workers = NR_WORKERS;
+	unsigned long expected;
+
+	if (argc > 1)
+		nr_workers = get_argv(argv[1]);
+	if (argc > 2)
+		nr_producers = get_argv(argv[2]);
+
+	numbers = uthread_chan_create(sizeof(unsigned long), CAPACITY);
+	squares = uthread_chan_create(sizeof(unsigned long), 0);
+
+	uthread_run_workers(nr_workers, false, collector, NULL);
+
+	// Sum of the squares from 1 to COUNT, for each producer
+	expected = (unsigned long)COUNT * (COUNT + 1) * (2 * COUNT + 1) / 6 * nr_producers;
+	printf("received = %lu (expected %u), sum = %lu (expected %lu)\n",
+	       received, COUNT * nr_producers, sum, expected);
+
+	uthread_chan_destroy(squares);
+	uthread_chan_destroy(numbers);
+
+	return received != COUNT * nr_producers || sum != expected;
+}
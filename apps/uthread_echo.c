@@ -0,0 +1,153 @@
+/*
+ * Non-blocking I/O test
+ *
+ * A server thread listens on a loopback TCP socket and starts an echo thread
+ * for each connection it accepts. A number of client threads (32 by default)
+ * connect to it and each send a series of messages, reading every echo back
+ * before sending the next message. The threads run on several workers (2 by
+ * default) and only ever block in the uthread I/O functions, so the program
+ * should output:
+ *
+ * echoed = 3200 (expected 3200)
+ */
+
+#include <arpa/inet.h>
+#include <limits.h>
+#include <netinet/in.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <io.h>
+#include <uthread.h>
+
+#define NR_CLIENTS	32
+#define NR_WORKERS	2
+#define MESSAGES	100
+
+static unsigned int nr_clients = NR_CLIENTS;
+static struct sockaddr_in server_addr;
+static atomic_uint echoed;
+
+/* Reads exactly @count bytes */
+static int read_all(int fd, char *buf, size_t count)
+{
+	while (count > 0) {
+		ssize_t ret = uthread_read(fd, buf, count);
+
+		if (ret <= 0)
+			return -1;
+		buf += ret;
+		count -= ret;
+	}
+	return 0;
+}
+
+static void echo(void *arg)
+{
+	int fd = (long)arg;
+	char buf[64];
+	ssize_t len;
+
+	while ((len = uthread_read(fd, buf, sizeof(buf))) > 0)
+		if (uthread_write(fd, buf, len) != len)
+			break;
+	close(fd);
+}
+
+static void server(void *arg)
+{
+	int listen_fd = (long)arg;
+	unsigned int i;
+
+	for (i = 0; i < nr_clients; i++) {
+		int fd = uthread_accept(listen_fd, NULL, NULL);
+
+		if (fd < 0) {
+			perror("uthread_accept");
+			break;
+		}
+		uthread_create(echo, (void *)(long)fd);
+	}
+	close(listen_fd);
+}
+
+static void client(void *arg)
+{
+	unsigned int id = (long)arg;
+	char msg[32], buf[32];
+	unsigned int i;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if (fd < 0 || uthread_connect(fd, (struct sockaddr *)&server_addr,
+				      sizeof(server_addr)) < 0) {
+		perror("uthread_connect");
+		exit(1);
+	}
+
+	for (i = 0; i < MESSAGES; i++) {
+		int len = snprintf(msg, sizeof(msg), "client %u message %u", id, i);
+
+		if (uthread_write(fd, msg, len) != len ||
+		    read_all(fd, buf, len) < 0)
+			break;
+		if (!memcmp(msg, buf, len))
+			echoed++;
+	}
+	close(fd);
+}
+
+static void start(void *arg)
+{
+	unsigned int i;
+
+	uthread_create(server, arg);
+	for (i = 0; i < nr_clients; i++)
+		uthread_create(client, (void *)(long)i);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nr_workers = NR_WORKERS;
+	socklen_t len = sizeof(server_addr);
+	int listen_fd;
+
+	if (argc > 1)
+		nr_workers = get_argv(argv[1]);
+	if (argc > 2)
+		nr_clients = get_argv(argv[2]);
+
+	// Listens on an ephemeral loopback port
+	listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	server_addr.sin_family = AF_INET;
+	server_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	server_addr.sin_port = 0;
+	if (listen_fd < 0 ||
+	    bind(listen_fd, (struct sockaddr *)&server_addr, len) < 0 ||
+	    listen(listen_fd, nr_clients) < 0 ||
+	    getsockname(listen_fd, (struct sockaddr *)&server_addr, &len) < 0) {
+		perror("listen");
+		return 1;
+	}
+
+	uthread_run_workers(nr_workers, false, start, (void *)(long)listen_fd);
+
+	printf("echoed = %u (expected %u)\n", echoed, nr_clients * MESSAGES);
+
+	return echoed != nr_clients * MESSAGES;
+}
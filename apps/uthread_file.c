@@ -0,0 +1,113 @@
+/*
+ * File I/O test
+ *
+ * A number of threads (128 by default), running on several workers (2 by
+ * default), each write their own block of a temporary file, flush it, and then
+ * read back the block written by another thread. The requests of all the
+ * threads are batched through the scheduler's io_uring (or done with blocking
+ * system calls if io_uring is unavailable). The program should output:
+ *
+ * verified = 128 (expected 128)
+ */
+
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <io.h>
+#include <sem.h>
+#include <uthread.h>
+
+#define NR_THREADS	128
+#define NR_WORKERS	2
+#define BLOCK_SIZE	4096
+
+static unsigned int nr_threads = NR_THREADS;
+static int fd;
+static atomic_uint written;
+static atomic_uint verified;
+static sem_t all_written;
+
+static void fill(char *block, unsigned int id)
+{
+	unsigned int i;
+
+	for (i = 0; i < BLOCK_SIZE; i++)
+		block[i] = (char)(id * 31 + i);
+}
+
+static void worker(void *arg)
+{
+	unsigned int id = (long)arg;
+	unsigned int other = (id + 1) % nr_threads;
+	char block[BLOCK_SIZE], expected[BLOCK_SIZE];
+
+	fill(block, id);
+	if (uthread_pwrite(fd, block, BLOCK_SIZE, (off_t)id * BLOCK_SIZE) != BLOCK_SIZE ||
+	    uthread_fsync(fd) < 0) {
+		perror("uthread_pwrite");
+		exit(1);
+	}
+
+	// The last thread to write lets everybody read
+	if (++written == nr_threads)
+		for (unsigned int i = 0; i < nr_threads; i++)
+			sem_up(all_written);
+	sem_down(all_written);
+
+	fill(expected, other);
+	if (uthread_pread(fd, block, BLOCK_SIZE, (off_t)other * BLOCK_SIZE) == BLOCK_SIZE &&
+	    !memcmp(block, expected, BLOCK_SIZE))
+		verified++;
+}
+
+static void start(void *arg)
+{
+	unsigned int i;
+	(void)arg;
+
+	for (i = 0; i < nr_threads; i++)
+		uthread_create(worker, (void *)(long)i);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nr_workers = NR_WORKERS;
+	char path[] = "/tmp/uthread_file.XXXXXX";
+
+	if (argc > 1)
+		nr_workers = get_argv(argv[1]);
+	if (argc > 2)
+		nr_threads = get_argv(argv[2]);
+
+	fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	unlink(path);
+	all_written = sem_create(0);
+
+	uthread_run_workers(nr_workers, false, start, NULL);
+
+	printf("verified = %u (expected %u)\n", verified, nr_threads);
+
+	sem_destroy(all_written);
+	close(fd);
+
+	return verified != nr_threads;
+}
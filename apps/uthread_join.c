@@ -0,0 +1,101 @@
+/*
+ * Join test
+ *
+ * Computes a Fibonacci number (the 16th by default) on several workers (2 by
+ * default), with one joinable thread per call: each thread creates a thread
+ * per subproblem and joins them to add up their results. Threads are joined
+ * both before and after they exit. Meanwhile, a number of threads are
+ * detached, some right after being created and others once they exited. The
+ * program should output:
+ *
+ * fib(16) = 987 (expected 987), detached = 100 (expected 100)
+ */
+
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <uthread.h>
+
+#define FIB_N		16
+#define FIB_VALUE	987
+#define NR_DETACHED	100
+#define NR_WORKERS	2
+
+static atomic_uint detached;
+
+static void *fib(void *arg)
+{
+	long n = (long)arg;
+	uthread_t tid1, tid2;
+	void *res1, *res2;
+
+	if (n < 2)
+		return (void *)n;
+
+	if (uthread_create_joinable(&tid1, fib, (void *)(n - 1)) ||
+	    uthread_create_joinable(&tid2, fib, (void *)(n - 2))) {
+		fprintf(stderr, "uthread_create_joinable failed\n");
+		exit(1);
+	}
+	// The second thread usually exits while we wait for the first one
+	uthread_join(tid1, &res1);
+	uthread_join(tid2, &res2);
+
+	return (void *)((long)res1 + (long)res2);
+}
+
+static void *count(void *arg)
+{
+	(void)arg;
+
+	detached++;
+	return NULL;
+}
+
+static void start(void *arg)
+{
+	long *result = arg;
+	uthread_t tid;
+	void *res;
+	unsigned int i;
+
+	for (i = 0; i < NR_DETACHED; i++) {
+		uthread_create_joinable(&tid, count, NULL);
+		if (i % 2)
+			uthread_yield();
+		uthread_detach(tid);
+	}
+
+	uthread_create_joinable(&tid, fib, (void *)FIB_N);
+	uthread_join(tid, &res);
+	*result = (long)res;
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nr_workers = NR_WORKERS;
+	long result = 0;
+
+	if (argc > 1)
+		nr_workers = get_argv(argv[1]);
+
+	uthread_run_workers(nr_workers, false, start, &result);
+
+	printf("fib(%d) = %ld (expected %d), detached = %u (expected %d)\n",
+	       FIB_N, result, FIB_VALUE, detached, NR_DETACHED);
+
+	return result != FIB_VALUE || detached != NR_DETACHED;
+}
@@ -0,0 +1,125 @@
+/*
+ * Mutex and condition variable test
+ *
+ * A number of threads (32 by default), running on several workers (4 by
+ * default), go through a number of rounds. In each round, every thread
+ * increments a shared counter a number of times under a mutex, yielding with
+ * the mutex held once in a while so that the others pile up waiting for it,
+ * and then waits at a barrier built from a condition variable: the last
+ * thread to arrive broadcasts to the others. Before the barrier, each thread
+ * also takes one of a few slots for a while, waiting on a second condition
+ * variable that is signaled whenever a slot is given back. The program should
+ * output:
+ *
+ * count = 32000 (expected 32000), rounds = 10 (expected 10), slots taken = 320 (expected 320)
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <mutex.h>
+#include <uthread.h>
+
+#define NR_THREADS	32
+#define NR_WORKERS	4
+#define ROUNDS		10
+#define ITERATIONS	100
+#define NR_SLOTS	4
+
+static unsigned int nr_threads = NR_THREADS;
+static uthread_mutex_t mutex;
+static uthread_cond_t barrier, slot_freed;
+static unsigned int count, arrived, rounds, slots = NR_SLOTS, taken;
+
+static void barrier_wait(void)
+{
+	unsigned int round = rounds;
+
+	if (++arrived == nr_threads) {
+		arrived = 0;
+		rounds++;
+		uthread_cond_broadcast(barrier);
+		return;
+	}
+	while (rounds == round)
+		uthread_cond_wait(barrier, mutex);
+}
+
+static void worker(void *arg)
+{
+	unsigned int round, i;
+	(void)arg;
+
+	for (round = 0; round < ROUNDS; round++) {
+		for (i = 0; i < ITERATIONS; i++) {
+			uthread_mutex_lock(mutex);
+			count++;
+			if (i % 10 == 0)
+				uthread_yield();
+			uthread_mutex_unlock(mutex);
+		}
+
+		uthread_mutex_lock(mutex);
+		while (slots == 0)
+			uthread_cond_wait(slot_freed, mutex);
+		slots--;
+		taken++;
+		uthread_mutex_unlock(mutex);
+
+		uthread_yield();
+
+		uthread_mutex_lock(mutex);
+		slots++;
+		uthread_cond_signal(slot_freed);
+		barrier_wait();
+		uthread_mutex_unlock(mutex);
+	}
+}
+
+static void start(void *arg)
+{
+	unsigned int i;
+	(void)arg;
+
+	for (i = 0; i < nr_threads; i++)
+		uthread_create(worker, (void *)(long)i);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nr_workers = NR_WORKERS;
+
+	if (argc > 1)
+		nr_workers = get_argv(argv[1]);
+	if (argc > 2)
+		nr_threads = get_argv(argv[2]);
+
+	mutex = uthread_mutex_create();
+	barrier = uthread_cond_create();
+	slot_freed = uthread_cond_create();
+
+	uthread_run_workers(nr_workers, false, start, NULL);
+
+	printf("count = %u (expected %u), rounds = %u (expected %u), slots taken = %u (expected %u)\n",
+	       count, nr_threads * ROUNDS * ITERATIONS, rounds, ROUNDS,
+	       taken, nr_threads * ROUNDS);
+
+	uthread_cond_destroy(slot_freed);
+	uthread_cond_destroy(barrier);
+	uthread_mutex_destroy(mutex);
+
+	return count != nr_threads * ROUNDS * ITERATIONS || rounds != ROUNDS ||
+	       taken != nr_threads * ROUNDS;
+}
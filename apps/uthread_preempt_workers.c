@@ -0,0 +1,106 @@
+/*
+ * Preemption on several workers test
+ *
+ * A number of threads (8 by default) run on fewer workers (4 by default) with
+ * preemption enabled. Each thread first spins, never yielding, until all the
+ * threads have started, which only happens if the workers' timers preempt the
+ * spinning threads. Each thread then increments a shared counter a number of
+ * times (100000 by default) under a semaphore, so that ticks keep landing in
+ * the library's critical sections and get deferred. The program should output:
+ *
+ * Preempting started
+ * all 8 threads ran on 4 workers
+ * count = 800000 (expected 800000)
+ * involuntary switches ok
+ */
+
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define NR_THREADS	8
+#define NR_WORKERS	4
+#define NR_INCREMENTS	100000
+#define SPIN_NS		10000000000ull
+
+static unsigned int nr_threads = NR_THREADS;
+static unsigned int nr_increments = NR_INCREMENTS;
+static atomic_uint started, timed_out;
+static unsigned long count;
+static sem_t lock;
+
+static void thread(void *arg)
+{
+	uint64_t deadline = uthread_clock_ns() + SPIN_NS;
+	unsigned int i;
+	(void)arg;
+
+	// Never yields, the threads left waiting for a worker must preempt us
+	atomic_fetch_add(&started, 1);
+	while (atomic_load(&started) < nr_threads) {
+		if (uthread_clock_ns() > deadline) {
+			atomic_fetch_add(&timed_out, 1);
+			break;
+		}
+	}
+
+	for (i = 0; i < nr_increments; i++) {
+		sem_down(lock);
+		count++;
+		sem_up(lock);
+	}
+}
+
+static void thread1(void *arg)
+{
+	unsigned int i;
+	(void)arg;
+
+	for (i = 0; i < nr_threads; i++)
+		uthread_create(thread, NULL);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nr_workers = NR_WORKERS;
+	struct uthread_stats stats;
+
+	if (argc > 1)
+		nr_workers = get_argv(argv[1]);
+	if (argc > 2)
+		nr_threads = get_argv(argv[2]);
+	if (argc > 3)
+		nr_increments = get_argv(argv[3]);
+
+	lock = sem_create(1);
+	uthread_run_workers(nr_workers, true, thread1, NULL);
+	sem_destroy(lock);
+	uthread_stats(&stats);
+
+	if (timed_out)
+		printf("%u threads gave up waiting for the others\n", timed_out);
+	else
+		printf("all %u threads ran on %u workers\n", started, nr_workers);
+	printf("count = %lu (expected %lu)\n", count,
+	       (unsigned long)nr_threads * nr_increments);
+	printf("involuntary switches %s\n",
+	       stats.threads.involuntary_switches > 0 ? "ok" : "none");
+
+	return timed_out || count != (unsigned long)nr_threads * nr_increments ||
+	       stats.threads.involuntary_switches == 0;
+}
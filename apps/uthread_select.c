@@ -0,0 +1,174 @@
+/*
+ * Select test
+ *
+ * A number of producer threads (4 by default) send numbers on whichever of
+ * two unbuffered channels has a receiver waiting, while a ticker thread raises
+ * a semaphore a fixed number of times, all running on several workers (4 by
+ * default). A single collector thread waits on both channels, the semaphore
+ * and a watchdog timeout at once, until the last producer closes both
+ * channels and all the ticks are in. The collector then checks that a
+ * select on a timeout alone sleeps until its deadline. The program should
+ * output:
+ *
+ * received = 4000 (expected 4000), sum = 2002000 (expected 2002000), ticks = 100 (expected 100)
+ * timeout fired on time
+ */
+
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chan.h>
+#include <select.h>
+#include <sem.h>
+#include <uthread.h>
+
+#define NR_PRODUCERS	4
+#define NR_WORKERS	4
+#define COUNT		1000
+#define NR_TICKS	100
+#define WATCHDOG_NS	1000000000ull
+#define TIMEOUT_NS	10000000ull
+
+static unsigned int nr_producers = NR_PRODUCERS;
+static uthread_chan_t channels[2];
+static sem_t ticks;
+static atomic_uint producing;
+static unsigned long received, sum, nr_ticks;
+static bool stalled, on_time;
+
+static void producer(void *arg)
+{
+	struct uthread_select_case cases[2];
+	unsigned long i;
+	int c;
+	(void)arg;
+
+	for (c = 0; c < 2; c++) {
+		cases[c].type = UTHREAD_SELECT_SEND;
+		cases[c].chan = channels[c];
+		cases[c].elem = &i;
+	}
+
+	for (i = 1; i <= COUNT; i++)
+		uthread_select(cases, 2);
+
+	if (--producing == 0) {
+		uthread_chan_close(channels[0]);
+		uthread_chan_close(channels[1]);
+	}
+}
+
+static void ticker(void *arg)
+{
+	int i;
+	(void)arg;
+
+	for (i = 0; i < NR_TICKS; i++) {
+		sem_up(ticks);
+		uthread_yield();
+	}
+}
+
+static void collector(void *arg)
+{
+	struct uthread_select_case cases[4];
+	bool open[2] = { true, true };
+	unsigned long n;
+	unsigned int i;
+	uint64_t start;
+	int count, c, fired;
+	(void)arg;
+
+	producing = nr_producers;
+	for (i = 0; i < nr_producers; i++)
+		uthread_create(producer, NULL);
+	uthread_create(ticker, NULL);
+
+	while (open[0] || open[1] || nr_ticks < NR_TICKS) {
+		// Only waits on what can still fire
+		count = 0;
+		for (c = 0; c < 2; c++) {
+			if (!open[c])
+				continue;
+			cases[count].type = UTHREAD_SELECT_RECV;
+			cases[count].chan = channels[c];
+			cases[count].elem = &n;
+			count++;
+		}
+		if (nr_ticks < NR_TICKS) {
+			cases[count].type = UTHREAD_SELECT_SEM;
+			cases[count].sem = ticks;
+			count++;
+		}
+		cases[count].type = UTHREAD_SELECT_TIMEOUT;
+		cases[count].deadline = uthread_clock_ns() + WATCHDOG_NS;
+		count++;
+
+		fired = uthread_select(cases, count);
+		if (cases[fired].type == UTHREAD_SELECT_TIMEOUT) {
+			stalled = true;
+			return;
+		}
+		if (cases[fired].type == UTHREAD_SELECT_SEM) {
+			nr_ticks++;
+		} else if (cases[fired].result < 0) {
+			open[cases[fired].chan == channels[1]] = false;
+		} else {
+			received++;
+			sum += n;
+		}
+	}
+
+	start = uthread_clock_ns();
+	cases[0].type = UTHREAD_SELECT_TIMEOUT;
+	cases[0].deadline = start + TIMEOUT_NS;
+	on_time = uthread_select(cases, 1) == 0 && uthread_clock_ns() >= start + TIMEOUT_NS;
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nr_workers = NR_WORKERS;
+	unsigned long expected;
+
+	if (argc > 1)
+		nr_workers = get_argv(argv[1]);
+	if (argc > 2)
+		nr_producers = get_argv(argv[2]);
+
+	channels[0] = uthread_chan_create(sizeof(unsigned long), 0);
+	channels[1] = uthread_chan_create(sizeof(unsigned long), 0);
+	ticks = sem_create(0);
+
+	uthread_run_workers(nr_workers, false, collector, NULL);
+
+	if (stalled)
+		printf("collector stalled\n");
+
+	// Sum of the numbers from 1 to COUNT, for each producer
+	expected = (unsigned long)COUNT * (COUNT + 1) / 2 * nr_producers;
+	printf("received = %lu (expected %u), sum = %lu (expected %lu), ticks = %lu (expected %d)\n",
+	       received, COUNT * nr_producers, sum, expected, nr_ticks, NR_TICKS);
+	printf("timeout fired %s\n", on_time ? "on time" : "early");
+
+	sem_destroy(ticks);
+	uthread_chan_destroy(channels[1]);
+	uthread_chan_destroy(channels[0]);
+
+	return stalled || !on_time || received != COUNT * nr_producers || sum != expected ||
+	       nr_ticks != NR_TICKS;
+}
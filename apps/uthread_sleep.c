@@ -0,0 +1,149 @@
+/*
+ * Sleep test
+ *
+ * A number of threads (64 by default), created in random order on several
+ * workers (2 by default), each sleep for a different duration, from 1 ms to
+ * over half a second so as to span several levels of the scheduler's timing
+ * wheel. Half of them use relative sleeps, the other half absolute deadlines.
+ * The threads should wake up in the order of their deadline, and never before
+ * it.
+ *
+ * Then, on a single worker, a few threads (4) sleep for 1 ms more than each
+ * other while a busy thread keeps the worker for 20 ms, so that all their
+ * timers expire at once; they should still wake up in the order of their
+ * deadline. The program should output:
+ *
+ * woken = 64 (expected 64), early = 0, out of order = 0
+ * expired at once, woken in order: 0 1 2 3
+ */
+
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <uthread.h>
+
+#define NR_THREADS	64
+#define NR_WORKERS	2
+#define STEP_NS		10000000	/* Between the deadlines of two threads */
+#define NR_BATCH	4
+#define BATCH_STEP_NS	1000000
+#define BUSY_NS		20000000
+
+static unsigned int nr_threads = NR_THREADS;
+static uint64_t start;
+static atomic_uint woken, early, out_of_order;
+static atomic_uint last_woken;
+static unsigned int batch_order[NR_BATCH], batch_woken;
+
+static void sleeper(void *arg)
+{
+	unsigned int id = (long)arg;
+	uint64_t deadline = start + 1000000 + (uint64_t)id * STEP_NS;
+
+	if (id % 2)
+		uthread_sleep_until(deadline);
+	else
+		uthread_sleep_ns(deadline - uthread_clock_ns());
+
+	if (uthread_clock_ns() < deadline)
+		early++;
+	// Threads 10 ms apart must wake up in order, even on different workers
+	if (atomic_exchange(&last_woken, id + 1) > id + 1)
+		out_of_order++;
+	woken++;
+}
+
+static void spawn(void *arg)
+{
+	unsigned int *order = arg;
+	unsigned int i;
+
+	start = uthread_clock_ns();
+	for (i = 0; i < nr_threads; i++)
+		uthread_create(sleeper, (void *)(long)order[i]);
+}
+
+static void batch_sleeper(void *arg)
+{
+	unsigned int id = (long)arg;
+
+	uthread_sleep_until(start + (uint64_t)(id + 1) * BATCH_STEP_NS);
+	batch_order[batch_woken++] = id;
+}
+
+static void busy(void *arg)
+{
+	(void)arg;
+
+	// Never yields, so the timers only get expired once done
+	while (uthread_clock_ns() < start + BUSY_NS);
+}
+
+static void batch(void *arg)
+{
+	int i;
+	(void)arg;
+
+	start = uthread_clock_ns();
+	for (i = NR_BATCH - 1; i >= 0; i--)
+		uthread_create(batch_sleeper, (void *)(long)i);
+	uthread_create(busy, NULL);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nr_workers = NR_WORKERS;
+	unsigned int *order;
+	unsigned int i;
+
+	if (argc > 1)
+		nr_workers = get_argv(argv[1]);
+	if (argc > 2)
+		nr_threads = get_argv(argv[2]);
+
+	// Shuffles the creation order
+	order = malloc(nr_threads * sizeof(*order));
+	for (i = 0; i < nr_threads; i++)
+		order[i] = i;
+	srand(42);
+	for (i = nr_threads - 1; i > 0; i--) {
+		unsigned int j = rand() % (i + 1);
+		unsigned int tmp = order[i];
+
+		order[i] = order[j];
+		order[j] = tmp;
+	}
+
+	uthread_run_workers(nr_workers, false, spawn, order);
+
+	printf("woken = %u (expected %u), early = %u, out of order = %u\n",
+	       woken, nr_threads, early, out_of_order);
+
+	uthread_run(false, batch, NULL);
+	printf("expired at once, woken in order:");
+	for (i = 0; i < batch_woken; i++)
+		printf(" %u", batch_order[i]);
+	printf("\n");
+
+	free(order);
+
+	for (i = 0; i < batch_woken; i++) {
+		if (batch_order[i] != i)
+			return 1;
+	}
+	return woken != nr_threads || early || out_of_order || batch_woken != NR_BATCH;
+}
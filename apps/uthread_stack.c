@@ -0,0 +1,125 @@
+/*
+ * Lazy stacks test
+ *
+ * With lazy stacks of 8 MiB, thread1 first creates a number of shallow threads
+ * (1000 by default) that wait until all of them are running, and checks that
+ * they take little resident memory each. It then runs a thread that recurses a
+ * few MiB deep, and checks that the memory it touched is given back once its
+ * stack returns to the pool. The program should output:
+ *
+ * shallow: 1000 threads on 8 MiB stacks, resident memory ok
+ * deep: recursed 16384 levels, resident memory given back
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define NR_SHALLOW	1000
+#define STACK_SIZE	(8 * 1024 * 1024)
+#define DEPTH		16384
+#define FRAME_SIZE	192
+#define MIB		(1024 * 1024)
+
+static unsigned int nr_shallow = NR_SHALLOW;
+static sem_t started, release;
+static long deepest;
+
+/* Resident memory of the process, in bytes */
+static long resident(void)
+{
+	FILE *statm = fopen("/proc/self/statm", "r");
+	long size, pages = 0;
+
+	if (statm == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+	if (fscanf(statm, "%ld %ld", &size, &pages) != 2)
+		pages = 0;
+	fclose(statm);
+	return pages * sysconf(_SC_PAGESIZE);
+}
+
+static unsigned int recurse(unsigned int depth)
+{
+	volatile char frame[FRAME_SIZE];
+
+	memset((char *)frame, depth, sizeof(frame));
+	if (depth == 0) {
+		deepest = resident();
+		return 0;
+	}
+	// Reading the frame after the call keeps the recursion from becoming a loop
+	return recurse(depth - 1) + 1 + (frame[0] != (char)depth);
+}
+
+static void *deep(void *arg)
+{
+	(void)arg;
+
+	return (void *)(long)recurse(DEPTH);
+}
+
+static void shallow(void *arg)
+{
+	(void)arg;
+
+	sem_up(started);
+	sem_down(release);
+}
+
+static void thread1(void *arg)
+{
+	long before, after;
+	uthread_t tid;
+	void *levels;
+	unsigned int i;
+	(void)arg;
+
+	started = sem_create(0);
+	release = sem_create(0);
+	before = resident();
+	for (i = 0; i < nr_shallow; i++)
+		uthread_create(shallow, NULL);
+	sem_down_n(started, nr_shallow);
+	after = resident();
+	printf("shallow: %u threads on %d MiB stacks, resident memory %s\n", nr_shallow,
+	       STACK_SIZE / MIB, after - before < 64 * 1024 * (long)nr_shallow ? "ok" : "too high");
+	sem_up_n(release, nr_shallow);
+
+	before = resident();
+	uthread_create_joinable(&tid, deep, NULL);
+	uthread_join(tid, &levels);
+	after = resident();
+	printf("deep: recursed %ld levels, resident memory %s\n", (long)levels,
+	       deepest - before >= 2 * MIB && after - before < MIB ? "given back" : "kept");
+
+	sem_destroy(started);
+	sem_destroy(release);
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc > 1)
+		nr_shallow = get_argv(argv[1]);
+
+	uthread_stack_config(UTHREAD_STACK_LAZY, STACK_SIZE);
+	return uthread_run(false, thread1, NULL);
+}
@@ -0,0 +1,108 @@
+/*
+ * Statistics test
+ *
+ * Thread1 runs three joinable threads next to each other, with preemption
+ * enabled: a yielder that yields a fixed number of times, a sleeper that
+ * sleeps for 20 ms, and a spinner that never gives its worker up until it gets
+ * preempted. Each checks its own statistics, while thread1 keeps yielding
+ * until the yielder and the spinner are done. Pass any argument to also print
+ * the full statistics. The program should output:
+ *
+ * Preempting started
+ * yielder: voluntary switches ok
+ * sleeper: blocked time ok
+ * spinner: involuntary switches ok
+ * threads: 4 created, 4 exited
+ */
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <uthread.h>
+
+#define NR_YIELDS	100
+#define SLEEP_NS	20000000ull
+#define SPIN_NS		2000000000ull
+
+static atomic_bool yielding = true, spinning = true;
+
+static void *yielder(void *arg)
+{
+	struct uthread_thread_stats stats;
+	int i;
+	(void)arg;
+
+	for (i = 0; i < NR_YIELDS; i++)
+		uthread_yield();
+	yielding = false;
+
+	// Thread1 keeps being ready, so that each yield switches
+	uthread_thread_stats(NULL, &stats);
+	return (void *)(uintptr_t)(stats.voluntary_switches >= NR_YIELDS);
+}
+
+static void *sleeper(void *arg)
+{
+	struct uthread_thread_stats stats;
+	(void)arg;
+
+	uthread_sleep_ns(SLEEP_NS);
+
+	uthread_thread_stats(NULL, &stats);
+	return (void *)(uintptr_t)(stats.blocked_ns >= SLEEP_NS && stats.run_ns < stats.blocked_ns);
+}
+
+static void *spinner(void *arg)
+{
+	struct uthread_thread_stats stats;
+	uint64_t start = uthread_clock_ns();
+	(void)arg;
+
+	do {
+		uthread_thread_stats(NULL, &stats);
+	} while (stats.involuntary_switches == 0 && uthread_clock_ns() - start < SPIN_NS);
+	spinning = false;
+
+	return (void *)(uintptr_t)(stats.involuntary_switches > 0);
+}
+
+static void thread1(void *arg)
+{
+	uthread_t tids[3];
+	void *ret;
+	(void)arg;
+
+	uthread_create_joinable(&tids[0], yielder, NULL);
+	uthread_create_joinable(&tids[1], sleeper, NULL);
+	uthread_create_joinable(&tids[2], spinner, NULL);
+
+	// Keeps the yielder switching, and the spinner preemptible
+	while (yielding || spinning)
+		uthread_yield();
+
+	uthread_join(tids[0], &ret);
+	printf("yielder: voluntary switches %s\n", ret ? "ok" : "too few");
+
+	uthread_join(tids[1], &ret);
+	printf("sleeper: blocked time %s\n", ret ? "ok" : "wrong");
+
+	uthread_join(tids[2], &ret);
+	printf("spinner: involuntary switches %s\n", ret ? "ok" : "none");
+}
+
+int main(int argc, char **argv)
+{
+	struct uthread_stats stats;
+	(void)argv;
+
+	uthread_run(true, thread1, NULL);
+
+	uthread_stats(&stats);
+	printf("threads: %lu created, %lu exited\n", stats.creates, stats.exits);
+	if (argc > 1)
+		uthread_stats_dump(stdout);
+
+	return stats.creates != stats.exits;
+}
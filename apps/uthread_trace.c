@@ -0,0 +1,86 @@
+/*
+ * Tracing test
+ *
+ * Two threads play ping-pong over a pair of semaphores for a number of rounds
+ * (10 by default), with tracing on. Thread1 then stops tracing, and main
+ * writes the recorded events as Chrome trace JSON, to the file given as
+ * argument if any, which chrome://tracing or Perfetto can open. The program
+ * should output:
+ *
+ * thread1: ping 1
+ * thread2: pong 1
+ * ...
+ * thread1: ping 10
+ * thread2: pong 10
+ * 89 events traced
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <sem.h>
+#include <trace.h>
+#include <uthread.h>
+
+#define NR_ROUNDS	10
+#define NR_EVENTS	4096
+
+static sem_t ping, pong;
+
+static void *thread2(void *arg)
+{
+	int i;
+	(void)arg;
+
+	for (i = 1; i <= NR_ROUNDS; i++) {
+		sem_down(ping);
+		printf("thread2: pong %d\n", i);
+		sem_up(pong);
+	}
+	return NULL;
+}
+
+static void thread1(void *arg)
+{
+	uthread_t tid;
+	int i;
+	(void)arg;
+
+	uthread_create_joinable(&tid, thread2, NULL);
+
+	for (i = 1; i <= NR_ROUNDS; i++) {
+		printf("thread1: ping %d\n", i);
+		sem_up(ping);
+		sem_down(pong);
+	}
+
+	uthread_join(tid, NULL);
+	uthread_trace_stop();
+}
+
+int main(int argc, char **argv)
+{
+	FILE *stream;
+	int count;
+
+	ping = sem_create(0);
+	pong = sem_create(0);
+
+	uthread_trace_start(NR_EVENTS);
+	uthread_run(false, thread1, NULL);
+
+	stream = fopen(argc > 1 ? argv[1] : "/dev/null", "w");
+	if (stream == NULL) {
+		perror("fopen");
+		exit(1);
+	}
+	count = uthread_trace_dump(stream);
+	fclose(stream);
+	printf("%d events traced\n", count);
+
+	uthread_trace_clear();
+	sem_destroy(ping);
+	sem_destroy(pong);
+
+	return count <= 0;
+}
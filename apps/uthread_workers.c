@@ -0,0 +1,129 @@
+/*
+ * Multiple workers test
+ *
+ * Runs a number of threads (64 by default) on several kernel worker threads (4
+ * by default). Each thread increments a shared counter protected by a
+ * semaphore a number of times, yielding in between, and pairs of threads
+ * ping-pong through two semaphores. The program should output the expected
+ * final count:
+ *
+ * count = 64000 (expected 64000)
+ *
+ * All the threads are created by a single thread, so the other workers have to
+ * steal them. A third argument prints how often each worker stole threads or
+ * went idle.
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <sem.h>
+#include <uthread.h>
+
+#define NR_THREADS	64
+#define NR_WORKERS	4
+#define ITERATIONS	1000
+
+static unsigned int nr_threads = NR_THREADS;
+static unsigned int count;
+static sem_t mutex;
+
+struct pair {
+	sem_t ping;
+	sem_t pong;
+};
+
+static void ping(void *arg)
+{
+	struct pair *p = arg;
+	unsigned int i;
+
+	for (i = 0; i < ITERATIONS; i++) {
+		sem_down(mutex);
+		count++;
+		sem_up(mutex);
+
+		sem_up(p->pong);
+		sem_down(p->ping);
+	}
+}
+
+static void pong(void *arg)
+{
+	struct pair *p = arg;
+	unsigned int i;
+
+	for (i = 0; i < ITERATIONS; i++) {
+		sem_down(p->pong);
+
+		sem_down(mutex);
+		count++;
+		sem_up(mutex);
+
+		uthread_yield();
+		sem_up(p->ping);
+	}
+}
+
+static void spawn(void *arg)
+{
+	struct pair *pairs = arg;
+	unsigned int i;
+
+	for (i = 0; i < nr_threads / 2; i++) {
+		uthread_create(ping, &pairs[i]);
+		uthread_create(pong, &pairs[i]);
+	}
+}
+
+static unsigned int get_argv(char *argv)
+{
+	long int ret = strtol(argv, NULL, 0);
+
+	if (ret == LONG_MIN || ret == LONG_MAX) {
+		perror("strtol");
+		exit(1);
+	}
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int nr_workers = NR_WORKERS;
+	struct pair *pairs;
+	unsigned int i;
+
+	if (argc > 1)
+		nr_workers = get_argv(argv[1]);
+	if (argc > 2)
+		nr_threads = get_argv(argv[2]) & ~1U;
+
+	mutex = sem_create(1);
+	pairs = malloc(nr_threads / 2 * sizeof(*pairs));
+	for (i = 0; i < nr_threads / 2; i++) {
+		pairs[i].ping = sem_create(0);
+		pairs[i].pong = sem_create(0);
+	}
+
+	uthread_run_workers(nr_workers, false, spawn, pairs);
+
+	printf("count = %u (expected %u)\n", count, nr_threads * ITERATIONS);
+
+	if (argc > 3) {
+		struct uthread_worker_stats stats;
+
+		for (i = 0; uthread_worker_stats(i, &stats) == 0; i++)
+			printf("worker %u: steals = %lu, idles = %lu\n",
+			       i, stats.steals, stats.idles);
+	}
+
+	for (i = 0; i < nr_threads / 2; i++) {
+		sem_destroy(pairs[i].ping);
+		sem_destroy(pairs[i].pong);
+	}
+	free(pairs);
+	sem_destroy(mutex);
+
+	return count != nr_threads * ITERATIONS;
+}
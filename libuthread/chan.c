@@ -0,0 +1,244 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "chan.h"
+#include "private.h"
+
+struct uthread_chan {
+	uthread_spinlock_t lock;	// Protects everything below against other workers
+	bool closed;
+	size_t size;
+	size_t capacity;
+	size_t head;	// Slot of the oldest element
+	size_t count;	// Number of elements held
+	struct uthread_wait_queue senders;
+	struct uthread_wait_queue receivers;
+	char buffer[];	// @capacity slots of @size bytes
+};
+
+/* Returns the address of a slot of the buffer */
+static void *chan_slot(uthread_chan_t chan, size_t index) {
+	return chan->buffer + (index % chan->capacity) * chan->size;
+}
+
+/* Creates an empty channel */
+uthread_chan_t uthread_chan_create(size_t size, size_t capacity) {
+	uthread_chan_t chan;
+
+	if (size == 0) {
+		return NULL;
+	}
+	chan = malloc(sizeof(*chan) + size * capacity);
+	if (chan == NULL) {
+		return NULL;
+	}
+	uthread_spin_init(&chan->lock);
+	chan->closed = false;
+	chan->size = size;
+	chan->capacity = capacity;
+	chan->head = 0;
+	chan->count = 0;
+	uthread_wait_init(&chan->senders);
+	uthread_wait_init(&chan->receivers);
+	return chan;
+}
+
+/* Destroys a channel nobody is blocked on */
+int uthread_chan_destroy(uthread_chan_t chan) {
+	if (chan == NULL || chan->senders.head != NULL || chan->receivers.head != NULL) {
+		return -1;
+	}
+	free(chan);
+	return 0;
+}
+
+/* Locks a channel, for uthread_select() */
+void chan_lock(uthread_chan_t chan) {
+	uthread_spin_lock(&chan->lock);
+}
+
+/* Unlocks a channel */
+void chan_unlock(uthread_chan_t chan) {
+	uthread_spin_unlock(&chan->lock);
+}
+
+/* Sends an element without blocking, with the channel locked */
+enum chan_status chan_try_send_locked(uthread_chan_t chan, const void *elem,
+				      struct uthread_waiter **wake) {
+	struct uthread_waiter *receiver;
+
+	*wake = NULL;
+	if (chan->closed) {
+		return CHAN_CLOSED;
+	}
+	// Receivers only wait on an empty channel, the element goes straight to one
+	receiver = uthread_wait_claim(&chan->receivers);
+	if (receiver != NULL) {
+		memcpy(receiver->elem, elem, chan->size);
+		receiver->done = true;
+		*wake = receiver;
+		return CHAN_DONE;
+	}
+	if (chan->count < chan->capacity) {
+		memcpy(chan_slot(chan, chan->head + chan->count), elem, chan->size);
+		chan->count++;
+		return CHAN_DONE;
+	}
+	return CHAN_NOT_READY;
+}
+
+/* Receives an element without blocking, with the channel locked */
+enum chan_status chan_try_recv_locked(uthread_chan_t chan, void *elem,
+				      struct uthread_waiter **wake) {
+	struct uthread_waiter *sender;
+
+	*wake = NULL;
+	if (chan->count > 0) {
+		memcpy(elem, chan_slot(chan, chan->head), chan->size);
+		chan->head = (chan->head + 1) % chan->capacity;
+		chan->count--;
+		// Makes room for the element of the oldest blocked sender
+		sender = uthread_wait_claim(&chan->senders);
+		if (sender != NULL) {
+			memcpy(chan_slot(chan, chan->head + chan->count), sender->elem, chan->size);
+			chan->count++;
+			sender->done = true;
+			*wake = sender;
+		}
+		return CHAN_DONE;
+	}
+	// Unbuffered, takes the element straight from the sender
+	sender = uthread_wait_claim(&chan->senders);
+	if (sender != NULL) {
+		memcpy(elem, sender->elem, chan->size);
+		sender->done = true;
+		*wake = sender;
+		return CHAN_DONE;
+	}
+	return chan->closed ? CHAN_CLOSED : CHAN_NOT_READY;
+}
+
+/* Queues a waiter on the channel, which is locked */
+void chan_wait_locked(uthread_chan_t chan, struct uthread_waiter *waiter, bool send) {
+	uthread_wait_push(send ? &chan->senders : &chan->receivers, waiter);
+}
+
+/* Dequeues a waiter whose operation did not complete, with the channel locked */
+void chan_unwait_locked(uthread_chan_t chan, struct uthread_waiter *waiter, bool send) {
+	uthread_wait_remove(send ? &chan->senders : &chan->receivers, waiter);
+}
+
+/* Blocks the current thread until a waker completes its operation, with the channel locked */
+static int chan_wait(uthread_chan_t chan, void *elem, bool send) {
+	struct uthread_waiter waiter;
+
+	uthread_waiter_init(&waiter, elem);
+	chan_wait_locked(chan, &waiter, send);
+	// The lock is only released once we have switched away
+	uthread_block(&chan->lock);
+	return waiter.done ? 0 : -1;
+}
+
+/* Sends an element, blocking until there is room for it or a receiver takes it */
+int uthread_chan_send(uthread_chan_t chan, const void *elem) {
+	struct uthread_waiter *receiver;
+	enum chan_status status;
+	int ret = 0;
+
+	if (chan == NULL) {
+		return -1;
+	}
+
+	// Disable preemption while we change the channel
+	preempt_disable();
+	uthread_spin_lock(&chan->lock);
+	status = chan_try_send_locked(chan, elem, &receiver);
+	if (status == CHAN_NOT_READY) {
+		ret = chan_wait(chan, (void *)elem, true);
+	} else {
+		uthread_spin_unlock(&chan->lock);
+		if (receiver != NULL) {
+			// Switches to the receiver, which got the element
+			uthread_waiter_wake(receiver, true);
+		}
+		if (status == CHAN_CLOSED) {
+			ret = -1;
+		}
+	}
+	// Critical section complete, enable preemption
+	preempt_enable();
+
+	return ret;
+}
+
+/* Receives an element, blocking until one is sent */
+int uthread_chan_recv(uthread_chan_t chan, void *elem) {
+	struct uthread_waiter *sender;
+	enum chan_status status;
+	int ret = 0;
+
+	if (chan == NULL) {
+		return -1;
+	}
+
+	// Disable preemption while we change the channel
+	preempt_disable();
+	uthread_spin_lock(&chan->lock);
+	status = chan_try_recv_locked(chan, elem, &sender);
+	if (status == CHAN_NOT_READY) {
+		ret = chan_wait(chan, elem, false);
+	} else {
+		uthread_spin_unlock(&chan->lock);
+		if (sender != NULL) {
+			uthread_waiter_wake(sender, false);
+		}
+		if (status == CHAN_CLOSED) {
+			ret = -1;
+		}
+	}
+	// Critical section complete, enable preemption
+	preempt_enable();
+
+	return ret;
+}
+
+/* Closes a channel, failing the sends and receives blocked on it */
+int uthread_chan_close(uthread_chan_t chan) {
+	struct uthread_wait_queue woken;
+	struct uthread_waiter *waiter;
+
+	if (chan == NULL) {
+		return -1;
+	}
+
+	// Disable preemption while we change the channel
+	preempt_disable();
+	uthread_spin_lock(&chan->lock);
+	if (chan->closed) {
+		uthread_spin_unlock(&chan->lock);
+		preempt_enable();
+		return -1;
+	}
+	chan->closed = true;
+	// Claims all the waiters that can be woken up, their operation failed
+	uthread_wait_init(&woken);
+	while ((waiter = uthread_wait_claim(&chan->senders)) != NULL) {
+		uthread_wait_push(&woken, waiter);
+	}
+	while ((waiter = uthread_wait_claim(&chan->receivers)) != NULL) {
+		uthread_wait_push(&woken, waiter);
+	}
+	uthread_spin_unlock(&chan->lock);
+
+	while ((waiter = woken.head) != NULL) {
+		// Their waiter is on their stack, not to be touched once they are unblocked
+		uthread_wait_remove(&woken, waiter);
+		uthread_waiter_wake(waiter, false);
+	}
+	// Critical section complete, enable preemption
+	preempt_enable();
+
+	return 0;
+}
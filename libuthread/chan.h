@@ -0,0 +1,83 @@
+#ifndef _UTHREAD_CHAN_H
+#define _UTHREAD_CHAN_H
+
+#include <stddef.h>
+
+/*
+ * uthread_chan_t - Channel type
+ *
+ * A channel carries fixed-size elements from sending threads to receiving
+ * threads, in order. A buffered channel holds up to a given number of
+ * elements, so that senders only block when it is full, and receivers when it
+ * is empty. An unbuffered channel holds none: each send waits for a receive,
+ * and the element is copied straight from the sender to the receiver.
+ *
+ * Once closed, a channel does not accept new elements anymore, but the
+ * elements it holds can still be received.
+ */
+typedef struct uthread_chan *uthread_chan_t;
+
+/*
+ * uthread_chan_create - Create channel
+ * @size: Size of the elements, in bytes
+ * @capacity: Number of elements the channel can hold, 0 for an unbuffered
+ *	channel
+ *
+ * Return: Pointer to initialized channel. NULL if @size is 0, or in case of
+ * failure when allocating the new channel.
+ */
+uthread_chan_t uthread_chan_create(size_t size, size_t capacity);
+
+/*
+ * uthread_chan_destroy - Deallocate a channel
+ * @chan: Channel to deallocate
+ *
+ * The elements still held by @chan are discarded.
+ *
+ * Return: -1 if @chan is NULL or if threads are still blocked on @chan. 0 if
+ * @chan was successfully destroyed.
+ */
+int uthread_chan_destroy(uthread_chan_t chan);
+
+/*
+ * uthread_chan_send - Send an element on a channel
+ * @chan: Channel to send on
+ * @elem: Element to send, of the size given to uthread_chan_create()
+ *
+ * If a thread is blocked receiving from @chan, @elem is copied directly into
+ * its destination, and the caller thread switches to it right away. Otherwise,
+ * @elem is stored if @chan has room for it, or the caller thread is blocked
+ * until a thread receives it.
+ *
+ * Return: -1 if @chan is NULL or is closed, including while the caller thread
+ * was blocked. 0 if @elem was successfully sent.
+ */
+int uthread_chan_send(uthread_chan_t chan, const void *elem);
+
+/*
+ * uthread_chan_recv - Receive an element from a channel
+ * @chan: Channel to receive from
+ * @elem: Where to copy the received element
+ *
+ * Take the oldest element held by @chan or, on an unbuffered channel, the
+ * element of the oldest blocked sender. If there is none, the caller thread is
+ * blocked until one is sent.
+ *
+ * Return: -1 if @chan is NULL, or if it is closed and holds no element anymore.
+ * 0 if an element was successfully received.
+ */
+int uthread_chan_recv(uthread_chan_t chan, void *elem);
+
+/*
+ * uthread_chan_close - Close a channel
+ * @chan: Channel to close
+ *
+ * Make further sends on @chan fail. Threads blocked sending on @chan, as well
+ * as threads blocked receiving from it, are unblocked and their call fails.
+ *
+ * Return: -1 if @chan is NULL or already closed. 0 if @chan was successfully
+ * closed.
+ */
+int uthread_chan_close(uthread_chan_t chan);
+
+#endif /* _UTHREAD_CHAN_H */
@@ -1,12 +1,111 @@
+#include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "private.h"
 #include "uthread.h"
 
-/* Size of the stack for a thread (in bytes) */
+/* Default size of the stack for a thread (in bytes) */
 #define UTHREAD_STACK_SIZE 32768
 
+#ifdef UTHREAD_CTX_ASM
+/*
+ * uthread_ctx_swap - Register-only context switch (x86-64 System V ABI)
+ * @prev_sp: Where to save the stack pointer of the current context
+ * @next_sp: Stack pointer of the context to resume
+ *
+ * Pushes the callee-saved registers and the MXCSR/x87 control words on the
+ * current stack, saves the resulting stack pointer in @prev_sp, and pops the
+ * same frame off @next_sp. The return address pushed by the caller is the
+ * resume point, so the final `ret` lands in the next context. Caller-saved
+ * registers are already spilled by the compiler around the call, and the
+ * signal mask is left untouched, so the switch never enters the kernel.
+ */
+void uthread_ctx_swap(void **prev_sp, void *next_sp);
+
+/*
+ * uthread_ctx_entry - First return address of a new context
+ *
+ * A context built by uthread_ctx_init() "returns" here from its first
+ * uthread_ctx_swap(), with the bootstrap function in %rbx and its two
+ * arguments in %r12 and %r13.
+ */
+void uthread_ctx_entry(void);
+
+__asm__(
+	"	.text\n"
+	"	.p2align 4\n"
+	"	.globl uthread_ctx_swap\n"
+	"	.hidden uthread_ctx_swap\n"
+	"	.type uthread_ctx_swap, @function\n"
+	"uthread_ctx_swap:\n"
+	"	pushq %rbp\n"
+	"	pushq %rbx\n"
+	"	pushq %r12\n"
+	"	pushq %r13\n"
+	"	pushq %r14\n"
+	"	pushq %r15\n"
+	"	subq $8, %rsp\n"
+	"	stmxcsr (%rsp)\n"
+	"	fnstcw 4(%rsp)\n"
+	"	movq %rsp, (%rdi)\n"
+	"	movq %rsi, %rsp\n"
+	"	ldmxcsr (%rsp)\n"
+	"	fldcw 4(%rsp)\n"
+	"	addq $8, %rsp\n"
+	"	popq %r15\n"
+	"	popq %r14\n"
+	"	popq %r13\n"
+	"	popq %r12\n"
+	"	popq %rbx\n"
+	"	popq %rbp\n"
+	"	ret\n"
+	"	.size uthread_ctx_swap, .-uthread_ctx_swap\n"
+	"\n"
+	"	.p2align 4\n"
+	"	.globl uthread_ctx_entry\n"
+	"	.hidden uthread_ctx_entry\n"
+	"	.type uthread_ctx_entry, @function\n"
+	"uthread_ctx_entry:\n"
+	"	movq %r12, %rdi\n"
+	"	movq %r13, %rsi\n"
+	"	call *%rbx\n"
+	"	ud2\n"
+	"	.size uthread_ctx_entry, .-uthread_ctx_entry\n"
+);
+
+/* Layout of the frame saved by uthread_ctx_swap(), from the stack pointer up */
+struct ctx_frame {
+	uint32_t mxcsr;
+	uint16_t fpu_cw;
+	uint16_t pad;
+	void *r15;
+	void *r14;
+	void *r13;
+	void *r12;
+	void *rbx;
+	void *rbp;
+	void *ret;
+};
+
+const char *uthread_ctx_backend(void)
+{
+	return "asm";
+}
+
+void uthread_ctx_switch(uthread_ctx_t *prev, uthread_ctx_t *next)
+{
+	uthread_ctx_swap(&prev->sp, next->sp);
+}
+#else
+const char *uthread_ctx_backend(void)
+{
+	return "ucontext";
+}
+
 void uthread_ctx_switch(uthread_ctx_t *prev, uthread_ctx_t *next)
 {
 	/*
@@ -18,15 +117,263 @@ void uthread_ctx_switch(uthread_ctx_t *prev, uthread_ctx_t *next)
 		exit(1);
 	}
 }
+#endif
+
+/* Default stack pool watermarks (in number of stacks of each size class) */
+#define STACK_POOL_LOW	4
+#define STACK_POOL_HIGH	64
+
+/* Number of stack size classes, class k holding stacks of 2^k pages */
+#define STACK_CLASSES	16
+
+/* Size of the top of a lazy stack that stays resident once recycled (in bytes) */
+#define STACK_RESIDENT	UTHREAD_STACK_SIZE
+
+/* Cached stacks of one size class */
+struct stack_class {
+	void *free_list;
+	size_t count;
+};
+
+/*
+ * Stack pool
+ *
+ * Stacks are mmap'd with a PROT_NONE guard page right below them, so that an
+ * overflow faults instead of silently corrupting the neighbouring memory.
+ * Their sizes are rounded up to a power of two pages, which makes for a few
+ * size classes. Released stacks are kept on the free list of their class,
+ * linked through their highest word (the one page every stack touches), and
+ * handed out again by the next allocation of the same class.
+ *
+ * In lazy mode, stacks are mapped with MAP_NORESERVE, so that reserving large
+ * stacks does not count against the commit limit, and whatever a thread
+ * touched below the top STACK_RESIDENT bytes of its stack is given back with
+ * MADV_DONTNEED when the stack is released. A deep call chain then only holds
+ * memory while it runs.
+ *
+ * The class of the default size is filled up to the low watermark when the
+ * library starts, the others only fill up as their stacks get released. When
+ * a release brings a class above the high watermark, that class is trimmed
+ * back down to the low watermark.
+ */
+struct stack_pool {
+	uthread_spinlock_t lock;	// Shared by all the workers
+	struct stack_class classes[STACK_CLASSES];
+	size_t count;	// Over all the classes
+	enum uthread_stack_mode mode;
+	size_t default_size;	// Requested size, rounded once the page size is known
+	bool started;
+	size_t low;
+	size_t high;
+	unsigned long hits;
+	unsigned long misses;
+};
+
+static struct stack_pool pool = {
+	.mode = UTHREAD_STACK_RESERVED,
+	.default_size = UTHREAD_STACK_SIZE,
+	.low = STACK_POOL_LOW,
+	.high = STACK_POOL_HIGH,
+};
+
+static size_t guard_size;
+
+/* Size class of a stack size returned by uthread_ctx_stack_size() */
+static struct stack_class *stack_class(size_t size)
+{
+	unsigned int k = 0;
+
+	while ((guard_size << k) < size)
+		k++;
+	return &pool.classes[k];
+}
+
+/* Free list link of a cached stack of @size bytes */
+static void **stack_link(void *stack, size_t size)
+{
+	return (void **)((char *)stack + size) - 1;
+}
+
+/* Maps a new stack segment of @size bytes and its guard page */
+static void *stack_map(size_t size)
+{
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+	char *base;
+
+	if (pool.mode == UTHREAD_STACK_LAZY)
+		flags |= MAP_NORESERVE;
+
+	base = mmap(NULL, guard_size + size, PROT_READ | PROT_WRITE, flags, -1, 0);
+	if (base == MAP_FAILED)
+		return NULL;
+
+	// Lowest page is the guard page
+	if (mprotect(base, guard_size, PROT_NONE)) {
+		munmap(base, guard_size + size);
+		return NULL;
+	}
+
+	return base + guard_size;
+}
+
+/* Unmaps a stack segment along with its guard page */
+static void stack_unmap(void *stack, size_t size)
+{
+	munmap((char *)stack - guard_size, guard_size + size);
+}
+
+/* Unmaps cached stacks of @size bytes until their class is down to @target */
+static void stack_pool_trim(size_t size, size_t target)
+{
+	struct stack_class *class = stack_class(size);
+
+	while (class->count > target && class->free_list != NULL) {
+		void *stack = class->free_list;
+
+		class->free_list = *stack_link(stack, size);
+		stack_unmap(stack, size);
+		class->count--;
+		pool.count--;
+	}
+}
+
+size_t uthread_ctx_stack_size(size_t size)
+{
+	size_t class_size = guard_size;
+
+	if (size == 0)
+		size = pool.default_size;
+
+	for (unsigned int k = 0; k < STACK_CLASSES; k++, class_size <<= 1) {
+		if (class_size >= size)
+			return class_size;
+	}
+	return 0;
+}
+
+void *uthread_ctx_alloc_stack(size_t size)
+{
+	struct stack_class *class = stack_class(size);
+	void *stack;
+
+	uthread_spin_lock(&pool.lock);
+	stack = class->free_list;
+	if (stack == NULL) {
+		pool.misses++;
+		uthread_spin_unlock(&pool.lock);
+		return stack_map(size);
+	}
+
+	pool.hits++;
+	class->free_list = *stack_link(stack, size);
+	class->count--;
+	pool.count--;
+	uthread_spin_unlock(&pool.lock);
+
+	return stack;
+}
+
+void uthread_ctx_destroy_stack(void *top_of_stack, size_t size)
+{
+	struct stack_class *class;
+
+	if (top_of_stack == NULL)
+		return;
+
+	/*
+	 * The stack goes back on the free list right away, where a thread
+	 * created next may pick it up: it must not be the one we run on
+	 */
+	assert((char *)__builtin_frame_address(0) < (char *)top_of_stack ||
+	       (char *)__builtin_frame_address(0) >= (char *)top_of_stack + size);
+
+	// Gives the deep part of a lazy stack back, outside of the lock
+	if (pool.mode == UTHREAD_STACK_LAZY && size > STACK_RESIDENT)
+		madvise(top_of_stack, size - STACK_RESIDENT, MADV_DONTNEED);
+
+	class = stack_class(size);
+	uthread_spin_lock(&pool.lock);
+	*stack_link(top_of_stack, size) = class->free_list;
+	class->free_list = top_of_stack;
+	class->count++;
+	pool.count++;
+
+	if (class->count > pool.high)
+		stack_pool_trim(size, pool.low);
+	uthread_spin_unlock(&pool.lock);
+}
+
+int uthread_ctx_pool_start(void)
+{
+	struct stack_class *class;
+	size_t size;
+
+	guard_size = sysconf(_SC_PAGESIZE);
+	uthread_spin_init(&pool.lock);
+	pool.hits = 0;
+	pool.misses = 0;
+
+	size = uthread_ctx_stack_size(0);
+	class = stack_class(size);
+	while (class->count < pool.low) {
+		void *stack = stack_map(size);
+
+		if (stack == NULL) {
+			uthread_ctx_pool_stop();
+			return -1;
+		}
+		*stack_link(stack, size) = class->free_list;
+		class->free_list = stack;
+		class->count++;
+		pool.count++;
+	}
+
+	pool.started = true;
+	return 0;
+}
+
+void uthread_ctx_pool_stop(void)
+{
+	for (unsigned int k = 0; k < STACK_CLASSES; k++)
+		stack_pool_trim(guard_size << k, 0);
+	pool.started = false;
+}
+
+int uthread_stack_config(enum uthread_stack_mode mode, size_t size)
+{
+	// Cached stacks were mapped for the current mode
+	if (pool.started)
+		return -1;
+	if (mode != UTHREAD_STACK_RESERVED && mode != UTHREAD_STACK_LAZY)
+		return -1;
+	if (size > (size_t)sysconf(_SC_PAGESIZE) << (STACK_CLASSES - 1))
+		return -1;
+
+	pool.mode = mode;
+	pool.default_size = size != 0 ? size : UTHREAD_STACK_SIZE;
+
+	return 0;
+}
 
-void *uthread_ctx_alloc_stack(void)
+int uthread_stack_pool_config(size_t low, size_t high)
 {
-	return malloc(UTHREAD_STACK_SIZE);
+	if (low > high)
+		return -1;
+
+	pool.low = low;
+	pool.high = high;
+
+	return 0;
 }
 
-void uthread_ctx_destroy_stack(void *top_of_stack)
+void uthread_stack_pool_stats(struct uthread_stack_pool_stats *stats)
 {
-	free(top_of_stack);
+	if (stats == NULL)
+		return;
+
+	stats->hits = pool.hits;
+	stats->misses = pool.misses;
+	stats->cached = pool.count;
 }
 
 /*
@@ -37,8 +384,10 @@ void uthread_ctx_destroy_stack(void *top_of_stack)
 static void uthread_ctx_bootstrap(uthread_func_t func, void *arg)
 {
 	/*
-	 * Enable interrupts right after being elected to run for the first time
+	 * Complete the switch that elected us, and enable interrupts right after
+	 * being elected to run for the first time
 	 */
+	uthread_start();
 	preempt_enable();
 
 	/* Execute thread and when done, exit */
@@ -46,7 +395,40 @@ static void uthread_ctx_bootstrap(uthread_func_t func, void *arg)
 	uthread_exit();
 }
 
-int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
+#ifdef UTHREAD_CTX_ASM
+int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack, size_t size,
+		     uthread_func_t func, void *arg)
+{
+	/*
+	 * Build the frame uthread_ctx_swap() expects at the (16-byte aligned)
+	 * end of the stack segment, so that the first switch to @uctx pops
+	 * @func and @arg into callee-saved registers and returns into
+	 * uthread_ctx_entry() with a properly aligned stack
+	 */
+	uintptr_t end = ((uintptr_t)top_of_stack + size) & ~(uintptr_t)15;
+	struct ctx_frame *frame = (struct ctx_frame *)end - 1;
+
+	if (top_of_stack == NULL)
+		return -1;
+
+	/* New contexts inherit the current floating-point control state */
+	__asm__ volatile("stmxcsr %0" : "=m"(frame->mxcsr));
+	__asm__ volatile("fnstcw %0" : "=m"(frame->fpu_cw));
+	frame->pad = 0;
+	frame->r15 = NULL;
+	frame->r14 = NULL;
+	frame->r13 = arg;
+	frame->r12 = (void *)func;
+	frame->rbx = (void *)uthread_ctx_bootstrap;
+	frame->rbp = NULL;
+	frame->ret = (void *)uthread_ctx_entry;
+
+	uctx->sp = frame;
+
+	return 0;
+}
+#else
+int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack, size_t size,
 		     uthread_func_t func, void *arg)
 {
 	/*
@@ -59,7 +441,7 @@ int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
 	 * Change context @uctx's stack to the specified stack
 	 */
 	uctx->uc_stack.ss_sp = top_of_stack;
-	uctx->uc_stack.ss_size = UTHREAD_STACK_SIZE;
+	uctx->uc_stack.ss_size = size;
 
 	/*
 	 * Finish setting up context @uctx:
@@ -73,4 +455,4 @@ int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
 
 	return 0;
 }
-
+#endif
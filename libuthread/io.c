@@ -0,0 +1,337 @@
+/* For accept4() */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "io.h"
+#include "private.h"
+
+/* Maximum number of events retrieved by one epoll_wait() */
+#define MAX_EVENTS 64
+
+/* Epoll data of the eventfd and of the io_uring fd, which are not waited on by threads */
+#define KICK_EVENT -1
+#define RING_EVENT -2
+
+/* Threads waiting on an fd, to read from it or to write to it */
+struct io_fd {
+	struct uthread_list readers;
+	struct uthread_list writers;
+	bool added;	// Registered with epoll
+};
+
+static int epoll_fd = -1;
+static int kick_fd = -1;	// eventfd waking up a worker blocked in io_poll()
+
+// Waiting threads of each fd, indexed by fd
+static uthread_spinlock_t fds_lock;
+static struct io_fd *fds;
+static int nr_fds;
+
+// Number of threads blocked on an fd
+static atomic_int waiting;
+
+/* Creates the epoll instance of the scheduler, and the io_uring if available */
+int io_start(void) {
+	struct epoll_event kick_ev = { .events = EPOLLIN, .data.fd = KICK_EVENT };
+	struct epoll_event ring_ev = { .events = EPOLLIN, .data.fd = RING_EVENT };
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	kick_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (epoll_fd < 0 || kick_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, kick_fd, &kick_ev) < 0) {
+		io_stop();
+		return -1;
+	}
+	// File I/O falls back to blocking calls without io_uring, its completions wake the poller up
+	if (uring_start() == 0 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, uring_fd(), &ring_ev) < 0) {
+		uring_stop();
+	}
+	uthread_spin_init(&fds_lock);
+	atomic_store(&waiting, 0);
+	return 0;
+}
+
+/* Closes the epoll instance and the io_uring, no thread may be waiting anymore */
+void io_stop(void) {
+	uring_stop();
+	if (epoll_fd >= 0) {
+		close(epoll_fd);
+	}
+	if (kick_fd >= 0) {
+		close(kick_fd);
+	}
+	epoll_fd = -1;
+	kick_fd = -1;
+	free(fds);
+	fds = NULL;
+	nr_fds = 0;
+}
+
+/* Returns true if some thread is blocked on an fd or on file I/O */
+bool io_pending(void) {
+	return atomic_load(&waiting) > 0 || uring_pending();
+}
+
+/* Makes a worker blocked in io_poll() return */
+void io_kick(void) {
+	uint64_t one = 1;
+
+	if (write(kick_fd, &one, sizeof(one)) < 0) {
+		// The counter is already non-zero, the worker will wake up anyway
+	}
+}
+
+/* Returns the waiters of an fd, growing the table if needed; NULL on failure */
+static struct io_fd *fd_get(int fd) {
+	if (fd >= nr_fds) {
+		int size = nr_fds ? nr_fds : 64;
+		struct io_fd *grown;
+
+		while (size <= fd) {
+			size *= 2;
+		}
+		grown = realloc(fds, size * sizeof(*fds));
+		if (grown == NULL) {
+			return NULL;
+		}
+		for (int i = nr_fds; i < size; i++) {
+			uthread_list_init(&grown[i].readers);
+			uthread_list_init(&grown[i].writers);
+			grown[i].added = false;
+		}
+		fds = grown;
+		nr_fds = size;
+	}
+	return &fds[fd];
+}
+
+/* (Re)arms the one-shot epoll registration of an fd for its current waiters */
+static int fd_arm(int fd, struct io_fd *entry) {
+	struct epoll_event ev = { .events = EPOLLONESHOT, .data.fd = fd };
+	int op = entry->added ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+	if (entry->readers.length > 0) {
+		ev.events |= EPOLLIN;
+	}
+	if (entry->writers.length > 0) {
+		ev.events |= EPOLLOUT;
+	}
+
+	if (epoll_ctl(epoll_fd, op, fd, &ev) < 0) {
+		// The fd was closed and reused, or registered through a duplicate
+		if (errno != ENOENT && errno != EEXIST) {
+			return -1;
+		}
+		op = op == EPOLL_CTL_ADD ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+		if (epoll_ctl(epoll_fd, op, fd, &ev) < 0) {
+			return -1;
+		}
+	}
+	entry->added = true;
+	return 0;
+}
+
+/* Blocks the calling thread until @fd is ready for @events (EPOLLIN or EPOLLOUT) */
+static int io_wait(int fd, uint32_t events) {
+	struct uthread_tcb *curr = uthread_current();
+	struct io_fd *entry;
+	struct uthread_list *list;
+
+	if (curr == NULL || epoll_fd < 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+
+	// Disable preemption while we change the waiting lists
+	preempt_disable();
+	uthread_spin_lock(&fds_lock);
+
+	entry = fd_get(fd);
+	if (entry == NULL) {
+		uthread_spin_unlock(&fds_lock);
+		preempt_enable();
+		errno = ENOMEM;
+		return -1;
+	}
+	list = events == EPOLLIN ? &entry->readers : &entry->writers;
+	uthread_list_push(list, curr);
+	if (fd_arm(fd, entry) < 0) {
+		uthread_list_remove(list, curr);
+		uthread_spin_unlock(&fds_lock);
+		preempt_enable();
+		return -1;
+	}
+
+	// Held before no longer being runnable, so that the scheduler keeps going
+	uthread_hold();
+	atomic_fetch_add(&waiting, 1);
+	// The lock is only released once we have switched away
+	uthread_block(&fds_lock);
+
+	// Critical section complete, enable preemption
+	preempt_enable();
+	return 0;
+}
+
+/* Unblocks the threads waiting on an fd that became ready */
+static int fd_ready(int fd, uint32_t events) {
+	struct uthread_list woken;
+	struct uthread_tcb *uthread;
+	struct io_fd *entry;
+	int count = 0;
+
+	uthread_list_init(&woken);
+	uthread_spin_lock(&fds_lock);
+	entry = &fds[fd];
+	// Errors and hang-ups wake everybody up, their next call reports them
+	if (events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+		while ((uthread = uthread_list_pop(&entry->readers)) != NULL) {
+			uthread_list_push(&woken, uthread);
+		}
+	}
+	if (events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+		while ((uthread = uthread_list_pop(&entry->writers)) != NULL) {
+			uthread_list_push(&woken, uthread);
+		}
+	}
+	// The registration is one-shot, rearm it for the threads still waiting
+	if (entry->readers.length > 0 || entry->writers.length > 0) {
+		fd_arm(fd, entry);
+	}
+	uthread_spin_unlock(&fds_lock);
+
+	while ((uthread = uthread_list_pop(&woken)) != NULL) {
+		uthread_unblock(uthread);
+		atomic_fetch_sub(&waiting, 1);
+		uthread_release();
+		count++;
+	}
+	return count;
+}
+
+/* Waits for events up to @timeout ns, or for ever if negative */
+static int io_wait_events(struct epoll_event *events, int64_t timeout) {
+	struct timespec ts;
+	int n;
+
+	if (timeout <= 0) {
+		return epoll_wait(epoll_fd, events, MAX_EVENTS, timeout < 0 ? -1 : 0);
+	}
+
+	ts.tv_sec = timeout / 1000000000;
+	ts.tv_nsec = timeout % 1000000000;
+	n = epoll_pwait2(epoll_fd, events, MAX_EVENTS, &ts, NULL);
+	if (n < 0 && errno == ENOSYS) {
+		// Kernels older than 5.11 only wait in ms, round up so as not to wake up early
+		n = epoll_wait(epoll_fd, events, MAX_EVENTS, (timeout + 999999) / 1000000);
+	}
+	return n;
+}
+
+/* Waits up to @timeout ns (-1 for ever) for fds to become ready and unblocks their threads */
+int io_poll(int64_t timeout) {
+	struct epoll_event events[MAX_EVENTS];
+	int count;
+	int n;
+
+	// Submits the file I/O queued so far, no need to wait if some already completed
+	count = uring_poll();
+	if (count > 0) {
+		timeout = 0;
+	}
+
+	n = io_wait_events(events, timeout);
+	for (int i = 0; i < n; i++) {
+		if (events[i].data.fd == RING_EVENT) {
+			count += uring_poll();
+			continue;
+		}
+		if (events[i].data.fd == KICK_EVENT) {
+			uint64_t value;
+
+			// Kicked by another worker; only the waiting worker consumes the wakeup, so it cannot be lost
+			if (timeout != 0 && read(kick_fd, &value, sizeof(value)) < 0) {
+				// Already consumed
+			}
+			continue;
+		}
+		count += fd_ready(events[i].data.fd, events[i].events);
+	}
+	return count;
+}
+
+/* Returns true if a failed call should wait and retry */
+static bool would_block(void) {
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+/* Reads from an fd, blocking the calling thread until data is available */
+ssize_t uthread_read(int fd, void *buf, size_t count) {
+	ssize_t ret;
+
+	while ((ret = read(fd, buf, count)) < 0 && would_block()) {
+		if (errno != EINTR && io_wait(fd, EPOLLIN) < 0) {
+			break;
+		}
+	}
+	return ret;
+}
+
+/* Writes to an fd, blocking the calling thread until there is room */
+ssize_t uthread_write(int fd, const void *buf, size_t count) {
+	ssize_t ret;
+
+	while ((ret = write(fd, buf, count)) < 0 && would_block()) {
+		if (errno != EINTR && io_wait(fd, EPOLLOUT) < 0) {
+			break;
+		}
+	}
+	return ret;
+}
+
+/* Accepts a connection, blocking the calling thread until one is pending */
+int uthread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen) {
+	int ret;
+
+	while ((ret = accept4(fd, addr, addrlen, SOCK_NONBLOCK)) < 0 && would_block()) {
+		if (errno != EINTR && io_wait(fd, EPOLLIN) < 0) {
+			break;
+		}
+	}
+	return ret;
+}
+
+/* Connects a socket, blocking the calling thread until the connection completes */
+int uthread_connect(int fd, const struct sockaddr *addr, socklen_t addrlen) {
+	socklen_t len = sizeof(int);
+	int err;
+
+	if (connect(fd, addr, addrlen) == 0) {
+		return 0;
+	}
+	if (errno != EINPROGRESS && errno != EINTR) {
+		return -1;
+	}
+
+	// The connection goes on in the background, the socket is writable once done
+	if (io_wait(fd, EPOLLOUT) < 0) {
+		return -1;
+	}
+	if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+		return -1;
+	}
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+	return 0;
+}
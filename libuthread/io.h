@@ -0,0 +1,117 @@
+#ifndef _UTHREAD_IO_H
+#define _UTHREAD_IO_H
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+/*
+ * Non-blocking I/O
+ *
+ * These functions behave like their system call counterparts, except that
+ * when the operation would block, only the calling thread is blocked: the fd
+ * is registered with an epoll instance owned by the scheduler, and the thread
+ * is unblocked once the fd becomes ready, while the other threads keep
+ * running. The scheduler polls for ready fds whenever it runs out of ready
+ * threads.
+ *
+ * The fds must be in non-blocking mode (O_NONBLOCK), otherwise these calls
+ * block the whole worker like regular system calls. Several threads can wait
+ * on the same fd at the same time.
+ *
+ * Outside of uthread_run(), these functions fail with errno set to EAGAIN
+ * instead of blocking.
+ */
+
+/*
+ * uthread_read - Read from a file descriptor
+ * @fd: File descriptor to read from
+ * @buf: Buffer to read into
+ * @count: Maximum number of bytes to read
+ *
+ * Return: Number of bytes read, 0 at end of file, or -1 in case of failure
+ * (with errno set by read())
+ */
+ssize_t uthread_read(int fd, void *buf, size_t count);
+
+/*
+ * uthread_write - Write to a file descriptor
+ * @fd: File descriptor to write to
+ * @buf: Buffer to write from
+ * @count: Maximum number of bytes to write
+ *
+ * Return: Number of bytes written, or -1 in case of failure (with errno set by
+ * write())
+ */
+ssize_t uthread_write(int fd, const void *buf, size_t count);
+
+/*
+ * uthread_accept - Accept a connection on a socket
+ * @fd: Listening socket
+ * @addr: Address of the peer, or NULL
+ * @addrlen: Size of @addr, or NULL
+ *
+ * The accepted socket is in non-blocking mode.
+ *
+ * Return: Accepted socket, or -1 in case of failure (with errno set by
+ * accept())
+ */
+int uthread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+
+/*
+ * uthread_connect - Connect a socket
+ * @fd: Socket to connect
+ * @addr: Address to connect to
+ * @addrlen: Size of @addr
+ *
+ * Return: 0 once connected, or -1 in case of failure (with errno set by
+ * connect(), or to the error that made the connection fail)
+ */
+int uthread_connect(int fd, const struct sockaddr *addr, socklen_t addrlen);
+
+/*
+ * File I/O
+ *
+ * Regular files are always ready as far as epoll is concerned, so they go
+ * through an io_uring owned by the scheduler instead. The calling thread
+ * queues its request and blocks; the requests queued by all the threads that
+ * blocked in the meantime are submitted at once, the next time a thread
+ * yields or a worker runs out of ready threads. Each completion unblocks the
+ * thread that issued the request.
+ *
+ * If io_uring is unavailable (old kernel, or disabled), or when called outside
+ * of uthread_run(), these functions fall back to regular blocking system
+ * calls.
+ */
+
+/*
+ * uthread_pread - Read from a file at a given offset
+ * @fd: File descriptor to read from
+ * @buf: Buffer to read into
+ * @count: Maximum number of bytes to read
+ * @offset: File offset to read at
+ *
+ * Return: Number of bytes read, 0 at end of file, or -1 in case of failure
+ * (with errno set)
+ */
+ssize_t uthread_pread(int fd, void *buf, size_t count, off_t offset);
+
+/*
+ * uthread_pwrite - Write to a file at a given offset
+ * @fd: File descriptor to write to
+ * @buf: Buffer to write from
+ * @count: Maximum number of bytes to write
+ * @offset: File offset to write at
+ *
+ * Return: Number of bytes written, or -1 in case of failure (with errno set)
+ */
+ssize_t uthread_pwrite(int fd, const void *buf, size_t count, off_t offset);
+
+/*
+ * uthread_fsync - Flush a file to its storage device
+ * @fd: File descriptor to flush
+ *
+ * Return: 0 in case of success, or -1 in case of failure (with errno set)
+ */
+int uthread_fsync(int fd);
+
+#endif /* _UTHREAD_IO_H */
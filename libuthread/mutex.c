@@ -0,0 +1,216 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+#include "mutex.h"
+#include "private.h"
+
+// State of a mutex
+enum mutex_state {
+	UNLOCKED,
+	LOCKED,		// Held, nobody waits for it
+	CONTENDED,	// Held, and threads may be waiting for it
+};
+
+struct uthread_mutex {
+	atomic_int state;	// Only changed without the lock from UNLOCKED to LOCKED and back
+	uthread_spinlock_t lock;	// Protects the waiting list against other workers
+	struct uthread_list waiting_threads;
+};
+
+struct uthread_cond {
+	uthread_spinlock_t lock;
+	struct uthread_list waiting_threads;
+};
+
+/* Creates a free mutex */
+uthread_mutex_t uthread_mutex_create(void) {
+	uthread_mutex_t mutex = malloc(sizeof(*mutex));
+
+	if (mutex == NULL) {
+		return NULL;
+	}
+	atomic_init(&mutex->state, UNLOCKED);
+	uthread_spin_init(&mutex->lock);
+	uthread_list_init(&mutex->waiting_threads);
+	return mutex;
+}
+
+/* Destroys a mutex unless it is held */
+int uthread_mutex_destroy(uthread_mutex_t mutex) {
+	if (mutex == NULL || atomic_load(&mutex->state) != UNLOCKED) {
+		return -1;
+	}
+	free(mutex);
+	return 0;
+}
+
+/* Takes a free mutex without blocking; true if taken */
+static bool mutex_fast_lock(uthread_mutex_t mutex) {
+	int state = UNLOCKED;
+
+	return atomic_compare_exchange_strong_explicit(&mutex->state, &state, LOCKED,
+						       memory_order_acquire, memory_order_relaxed);
+}
+
+/* Takes a mutex, blocking until it is handed over if it is held */
+int uthread_mutex_lock(uthread_mutex_t mutex) {
+	if (mutex == NULL) {
+		return -1;
+	}
+	// Fast path, the mutex is free
+	if (mutex_fast_lock(mutex)) {
+		return 0;
+	}
+
+	// Disable preemption while we change the waiting list
+	preempt_disable();
+	uthread_spin_lock(&mutex->lock);
+	// Marked contended, so that the holder releases it through the slow path
+	if (atomic_exchange_explicit(&mutex->state, CONTENDED, memory_order_acquire) == UNLOCKED) {
+		// Released in the meantime
+		uthread_spin_unlock(&mutex->lock);
+	} else {
+		uthread_list_push(&mutex->waiting_threads, uthread_current());
+		// The lock is only released once we have switched away
+		uthread_block(&mutex->lock);
+		// Woken up by uthread_mutex_unlock(), which handed us the mutex
+	}
+	// Critical section complete, enable preemption
+	preempt_enable();
+
+	return 0;
+}
+
+/* Takes a mutex if it is free */
+int uthread_mutex_trylock(uthread_mutex_t mutex) {
+	if (mutex == NULL || !mutex_fast_lock(mutex)) {
+		return -1;
+	}
+	return 0;
+}
+
+/* Releases a mutex, handing it over to the oldest waiting thread if any */
+int uthread_mutex_unlock(uthread_mutex_t mutex) {
+	struct uthread_tcb *next;
+	int state = LOCKED;
+
+	if (mutex == NULL) {
+		return -1;
+	}
+	// Fast path, nobody waits
+	if (atomic_compare_exchange_strong_explicit(&mutex->state, &state, UNLOCKED,
+						    memory_order_release, memory_order_relaxed)) {
+		return 0;
+	}
+	if (state == UNLOCKED) {
+		return -1;
+	}
+
+	// Disable preemption while we change the waiting list
+	preempt_disable();
+	uthread_spin_lock(&mutex->lock);
+	next = uthread_list_pop(&mutex->waiting_threads);
+	if (next == NULL) {
+		atomic_store_explicit(&mutex->state, UNLOCKED, memory_order_release);
+	} else if (mutex->waiting_threads.length == 0) {
+		// Still held, now by @next; later lockers mark it contended again
+		atomic_store_explicit(&mutex->state, LOCKED, memory_order_release);
+	}
+	uthread_spin_unlock(&mutex->lock);
+
+	if (next != NULL) {
+		uthread_unblock(next);
+	}
+	// Critical section complete, enable preemption
+	preempt_enable();
+
+	return 0;
+}
+
+/* Creates a condition variable nobody waits on */
+uthread_cond_t uthread_cond_create(void) {
+	uthread_cond_t cond = malloc(sizeof(*cond));
+
+	if (cond == NULL) {
+		return NULL;
+	}
+	uthread_spin_init(&cond->lock);
+	uthread_list_init(&cond->waiting_threads);
+	return cond;
+}
+
+/* Destroys a condition variable if nobody waits on it */
+int uthread_cond_destroy(uthread_cond_t cond) {
+	if (cond == NULL || cond->waiting_threads.length > 0) {
+		return -1;
+	}
+	free(cond);
+	return 0;
+}
+
+/* Releases the mutex and blocks until the condition variable is signaled */
+int uthread_cond_wait(uthread_cond_t cond, uthread_mutex_t mutex) {
+	if (cond == NULL || mutex == NULL) {
+		return -1;
+	}
+
+	// Disable preemption while we change the waiting list
+	preempt_disable();
+	uthread_spin_lock(&cond->lock);
+	uthread_list_push(&cond->waiting_threads, uthread_current());
+	// Signals cannot get lost, they need the lock we hold
+	uthread_mutex_unlock(mutex);
+	// The lock is only released once we have switched away
+	uthread_block(&cond->lock);
+	// Critical section complete, enable preemption
+	preempt_enable();
+
+	return uthread_mutex_lock(mutex);
+}
+
+/* Unblocks the oldest thread waiting on the condition variable */
+int uthread_cond_signal(uthread_cond_t cond) {
+	struct uthread_tcb *next;
+
+	if (cond == NULL) {
+		return -1;
+	}
+
+	// Disable preemption while we change the waiting list
+	preempt_disable();
+	uthread_spin_lock(&cond->lock);
+	next = uthread_list_pop(&cond->waiting_threads);
+	uthread_spin_unlock(&cond->lock);
+
+	if (next != NULL) {
+		uthread_unblock(next);
+	}
+	// Critical section complete, enable preemption
+	preempt_enable();
+
+	return 0;
+}
+
+/* Unblocks all the threads waiting on the condition variable */
+int uthread_cond_broadcast(uthread_cond_t cond) {
+	struct uthread_list waiting_threads;
+
+	if (cond == NULL) {
+		return -1;
+	}
+
+	// Disable preemption while we change the waiting list
+	preempt_disable();
+	uthread_spin_lock(&cond->lock);
+	uthread_list_init(&waiting_threads);
+	uthread_list_splice(&waiting_threads, &cond->waiting_threads);
+	uthread_spin_unlock(&cond->lock);
+
+	uthread_unblock_all(&waiting_threads);
+	// Critical section complete, enable preemption
+	preempt_enable();
+
+	return 0;
+}
@@ -0,0 +1,125 @@
+#ifndef _UTHREAD_MUTEX_H
+#define _UTHREAD_MUTEX_H
+
+/*
+ * uthread_mutex_t - Mutex type
+ *
+ * A mutex protects a critical section: only one thread can hold it at a time.
+ * Taking a free mutex or releasing a mutex nobody waits for only costs an
+ * atomic operation, without going through the scheduler. Threads that find
+ * the mutex taken are blocked, and handed the mutex in turn, oldest first.
+ */
+typedef struct uthread_mutex *uthread_mutex_t;
+
+/*
+ * uthread_cond_t - Condition variable type
+ *
+ * A condition variable lets threads wait, with a mutex held, until another
+ * thread signals that the condition they wait for may have changed.
+ */
+typedef struct uthread_cond *uthread_cond_t;
+
+/*
+ * uthread_mutex_create - Create mutex
+ *
+ * Allocate and initialize a free mutex.
+ *
+ * Return: Pointer to initialized mutex. NULL in case of failure when
+ * allocating the new mutex.
+ */
+uthread_mutex_t uthread_mutex_create(void);
+
+/*
+ * uthread_mutex_destroy - Deallocate a mutex
+ * @mutex: Mutex to deallocate
+ *
+ * Return: -1 if @mutex is NULL or if it is held. 0 if @mutex was successfully
+ * destroyed.
+ */
+int uthread_mutex_destroy(uthread_mutex_t mutex);
+
+/*
+ * uthread_mutex_lock - Take a mutex
+ * @mutex: Mutex to take
+ *
+ * Taking a mutex held by another thread causes the caller thread to be blocked
+ * until the mutex is handed over to it.
+ *
+ * Return: -1 if @mutex is NULL. 0 if the mutex was successfully taken.
+ */
+int uthread_mutex_lock(uthread_mutex_t mutex);
+
+/*
+ * uthread_mutex_trylock - Take a mutex without blocking
+ * @mutex: Mutex to take
+ *
+ * Return: -1 if @mutex is NULL or if it is held. 0 if the mutex was
+ * successfully taken.
+ */
+int uthread_mutex_trylock(uthread_mutex_t mutex);
+
+/*
+ * uthread_mutex_unlock - Release a mutex
+ * @mutex: Mutex to release
+ *
+ * If threads are waiting for @mutex, the oldest one is unblocked and becomes
+ * its holder.
+ *
+ * Return: -1 if @mutex is NULL or if it is not held. 0 if the mutex was
+ * successfully released.
+ */
+int uthread_mutex_unlock(uthread_mutex_t mutex);
+
+/*
+ * uthread_cond_create - Create condition variable
+ *
+ * Return: Pointer to initialized condition variable. NULL in case of failure
+ * when allocating the new condition variable.
+ */
+uthread_cond_t uthread_cond_create(void);
+
+/*
+ * uthread_cond_destroy - Deallocate a condition variable
+ * @cond: Condition variable to deallocate
+ *
+ * Return: -1 if @cond is NULL or if threads are still waiting on it. 0 if
+ * @cond was successfully destroyed.
+ */
+int uthread_cond_destroy(uthread_cond_t cond);
+
+/*
+ * uthread_cond_wait - Wait on a condition variable
+ * @cond: Condition variable to wait on
+ * @mutex: Mutex held by the caller thread
+ *
+ * Atomically release @mutex and block the caller thread until @cond is
+ * signaled, then take @mutex again before returning. As another thread may
+ * run first and change the condition again, the caller should check it again
+ * in a loop.
+ *
+ * Return: -1 if @cond or @mutex is NULL. 0 otherwise.
+ */
+int uthread_cond_wait(uthread_cond_t cond, uthread_mutex_t mutex);
+
+/*
+ * uthread_cond_signal - Signal a condition variable
+ * @cond: Condition variable to signal
+ *
+ * Unblock the oldest thread waiting on @cond, if any.
+ *
+ * Return: -1 if @cond is NULL. 0 otherwise.
+ */
+int uthread_cond_signal(uthread_cond_t cond);
+
+/*
+ * uthread_cond_broadcast - Signal a condition variable to all its waiters
+ * @cond: Condition variable to signal
+ *
+ * Unblock all the threads waiting on @cond. They are moved to the run queues
+ * at once, in the order they started waiting.
+ *
+ * Return: -1 if @cond is NULL. 0 otherwise.
+ */
+int uthread_cond_broadcast(uthread_cond_t cond);
+
+#endif /* _UTHREAD_MUTEX_H */
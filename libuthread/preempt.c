@@ -1,76 +1,228 @@
+/* For SIGEV_THREAD_ID timers and gettid() */
+#define _GNU_SOURCE
+
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "private.h"
 #include "uthread.h"
 
+// Older C libraries don't name the target thread field of struct sigevent
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
 /*
- * Frequency of preemption
- * 100Hz is 100 times per second
+ * Default quantum: 10 ms of CPU time, i.e. preempting 100 times per second
  */
-#define HZ 100
+#define DEFAULT_QUANTUM 10000
 #define USEC 1000000 // Number of microseconds in a second
 
-sigset_t block_alarm;
+/*
+ * Preemption timer of a worker kernel thread. Every worker arms its own timer,
+ * which only signals that worker, and the timers of the running workers are
+ * linked together so that the quantum can be changed for all of them at once.
+ */
+struct preempt_timer {
+	timer_t id;
+	struct preempt_timer *next;
+};
+
+static pthread_mutex_t timers_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct preempt_timer *timers;
+static __thread struct preempt_timer worker_timer;
+static __thread bool worker_timer_armed;
+
+static bool preempt_enabled;
+static enum uthread_preempt_clock preempt_clock = UTHREAD_CLOCK_VIRTUAL;
+static unsigned long preempt_quantum = DEFAULT_QUANTUM;
+
 static struct sigaction old_sa;
 
-/* Simple helper function that yields when our alarm signal reaches it */
+/*
+ * Number of nested preempt_disable() calls on this kernel thread, and whether
+ * a tick arrived while preemption was disabled. Both are only ever accessed by
+ * their own kernel thread, from regular code or from the signal handler.
+ */
+static __thread volatile unsigned int preempt_depth;
+static __thread volatile bool preempt_pending;
+
+/* Simple helper function that yields when our alarm signal reaches it, or defers the yield to preempt_enable() */
 static void signal_handler(int signum) {
 	if (signum == SIGVTALRM) {
-        uthread_yield();
+		if (preempt_depth > 0) {
+			preempt_pending = true;
+			return;
+		}
+        uthread_preempt();
     }
 }
 
 /* Disables preemption temporarily */
 void preempt_disable(void) {
-	// Uses SIG_BLOCK to disable the alarm with a mask
-	sigprocmask(SIG_BLOCK, &block_alarm, NULL);
+	// No need to mask the alarm, the handler checks the depth
+	preempt_depth++;
+	atomic_signal_fence(memory_order_seq_cst);
 }
 
 /* Enables preemption temporarily */
 void preempt_enable(void) {
-	// Uses SIG_UNBLOCK to enable the alarm again with a mask
-	sigprocmask(SIG_UNBLOCK, &block_alarm, NULL);
+	atomic_signal_fence(memory_order_seq_cst);
+	// Leaving the outermost critical section, yield if a tick was deferred
+	if (--preempt_depth == 0 && preempt_pending) {
+		preempt_pending = false;
+		uthread_preempt();
+	}
+}
+
+/* Returns how deeply preemption is disabled, to be saved across a context switch */
+unsigned int preempt_save(void) {
+	return preempt_depth;
 }
 
-/* Starts thread preemption and initializes timer and signal variables. If preempt is false, does nothing. */
+/* Restores the depth saved by a thread that is being resumed */
+void preempt_restore(unsigned int depth) {
+	preempt_depth = depth;
+}
+
+/* Converts a quantum in microseconds into a periodic timer value */
+static struct itimerspec quantum_to_itimerspec(unsigned long quantum) {
+	struct itimerspec its;
+
+	its.it_interval.tv_sec = quantum / USEC;
+	its.it_interval.tv_nsec = (quantum % USEC) * 1000;
+	its.it_value = its.it_interval;
+	return its;
+}
+
+/* Starts thread preemption by installing the signal handler. If preempt is false, does nothing. */
 void preempt_start(bool preempt) {
 	if (preempt) {
 		// Initialize the sigaction struct that will send the SIGVTALRM signal and trigger signal_handler
 		struct sigaction sa;
 		sa.sa_handler = signal_handler;
 		sigemptyset(&sa.sa_mask); // Prevents other signals from being blocked
-		sa.sa_flags = 0; 
+		// The handler may switch to another thread without returning, so don't keep the alarm blocked meanwhile
+		sa.sa_flags = SA_NODEFER;
 		sigaction(SIGVTALRM, &sa, &old_sa);
-		
-		// Initialize the signal set for alarm blocking/unblocking
-		sigemptyset(&block_alarm);
-		sigaddset(&block_alarm, SIGVTALRM);
-		
-		// Initialize timer
-		struct itimerval timer = {0};
-		timer.it_interval.tv_usec = USEC/HZ; // firing 100 times per second
-		timer.it_value.tv_usec = USEC/HZ; // previous
-		setitimer(ITIMER_VIRTUAL, &timer, NULL); // (int which, const struct *value, struct itimerval *ovalue); // no old value
+
+		// Workers arm their own timer when they start running threads
+		preempt_enabled = true;
 	} else {
 		// Do nothing if preempt is false
 		return;
 	}
 }
 
-/* Stops thread preemption and restores previous timer config and signal*/
+/* Stops thread preemption and restores the previous signal action, once every worker disarmed its timer */
 void preempt_stop(void) {
+	if (!preempt_enabled) {
+		return;
+	}
+	preempt_enabled = false;
+
 	// Resets sigaction
 	sigaction(SIGVTALRM, &old_sa, NULL);
+}
 
-	// Resets timer behavior
-	struct itimerval timer = {0};
-	timer.it_interval.tv_usec = 0; // never firing
-	timer.it_value.tv_usec = 0; // previous
-	setitimer(ITIMER_VIRTUAL, &timer, NULL);
-}
\ No newline at end of file
+/* Creates and arms a timer that sends SIGVTALRM to the calling worker thread only */
+void preempt_timer_start(void) {
+	struct sigevent sev = {0};
+	clockid_t clock;
+
+	if (!preempt_enabled) {
+		return;
+	}
+
+	switch (preempt_clock) {
+	case UTHREAD_CLOCK_MONOTONIC:
+		clock = CLOCK_MONOTONIC;
+		break;
+	default:
+		/*
+		 * CPU time of this worker, the per-thread equivalent of
+		 * ITIMER_VIRTUAL and ITIMER_PROF. Not the process's CPU time,
+		 * which every worker's timer would measure as a whole, so that N
+		 * busy workers would each get N ticks per quantum.
+		 */
+		clock = CLOCK_THREAD_CPUTIME_ID;
+		break;
+	}
+
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = SIGVTALRM;
+	sev.sigev_notify_thread_id = gettid();
+	if (timer_create(clock, &sev, &worker_timer.id) < 0) {
+		perror("timer_create");
+		return;
+	}
+
+	// Registers the timer and arms it, under the lock so that a concurrent quantum change isn't missed
+	pthread_mutex_lock(&timers_lock);
+	struct itimerspec its = quantum_to_itimerspec(preempt_quantum);
+	timer_settime(worker_timer.id, 0, &its, NULL);
+	worker_timer.next = timers;
+	timers = &worker_timer;
+	worker_timer_armed = true;
+	pthread_mutex_unlock(&timers_lock);
+}
+
+/* Disarms and deletes the timer of the calling worker thread */
+void preempt_timer_stop(void) {
+	struct preempt_timer **p;
+
+	if (!worker_timer_armed) {
+		return;
+	}
+
+	pthread_mutex_lock(&timers_lock);
+	for (p = &timers; *p != &worker_timer; p = &(*p)->next);
+	*p = worker_timer.next;
+	pthread_mutex_unlock(&timers_lock);
+
+	timer_delete(worker_timer.id);
+	worker_timer_armed = false;
+}
+
+/* Selects the clock and quantum of the next runs */
+int uthread_preempt_config(enum uthread_preempt_clock clock, unsigned long quantum) {
+	if (quantum == 0 || clock > UTHREAD_CLOCK_MONOTONIC) {
+		return -1;
+	}
+	if (preempt_enabled && clock != preempt_clock) {
+		// The clock of armed timers cannot be changed
+		return -1;
+	}
+	preempt_clock = clock;
+	return uthread_preempt_quantum(quantum);
+}
+
+/* Changes the quantum, immediately rearming the timers of running workers */
+int uthread_preempt_quantum(unsigned long quantum) {
+	struct preempt_timer *timer;
+
+	if (quantum == 0) {
+		return -1;
+	}
+
+	// Must not be preempted while holding the lock
+	preempt_disable();
+	pthread_mutex_lock(&timers_lock);
+	preempt_quantum = quantum;
+	struct itimerspec its = quantum_to_itimerspec(quantum);
+	for (timer = timers; timer != NULL; timer = timer->next) {
+		timer_settime(timer->id, 0, &its, NULL);
+	}
+	pthread_mutex_unlock(&timers_lock);
+	preempt_enable();
+
+	return 0;
+}
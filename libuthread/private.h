@@ -10,10 +10,30 @@
 /**
  * Private context API
  */
+#include <stdatomic.h>
+#include <stdint.h>
 #include <ucontext.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
+#include "chan.h"
+#include "sem.h"
 #include "uthread.h"
 
+/*
+ * Context switch backend
+ *
+ * On x86-64, contexts are switched by a small assembly routine that only saves
+ * the callee-saved registers, the FPU/SSE control words and the stack pointer,
+ * and never enters the kernel. Building with `make CTX=ucontext` (or building
+ * for any other architecture) selects the portable getcontext()/swapcontext()
+ * backend instead.
+ */
+#if defined(__x86_64__) && !defined(UTHREAD_CTX_UCONTEXT)
+#define UTHREAD_CTX_ASM
+#endif
+
 /*
  * uthread_ctx_t - User-level thread context
  *
@@ -24,7 +44,13 @@
  * uthread_ctx_init(). Once initialized, it can be switched to with
  * uthread_ctx_switch().
  */
+#ifdef UTHREAD_CTX_ASM
+typedef struct uthread_ctx {
+	void *sp;	/* Saved stack pointer, registers are stored on the stack */
+} uthread_ctx_t;
+#else
 typedef ucontext_t uthread_ctx_t;
+#endif
 
 /*
  * uthread_ctx_switch - Switch between two execution contexts
@@ -34,31 +60,69 @@ typedef ucontext_t uthread_ctx_t;
  */
 void uthread_ctx_switch(uthread_ctx_t *prev, uthread_ctx_t *next);
 
+/*
+ * uthread_ctx_stack_size - Get the actual size of a stack
+ * @size: Requested size (in bytes), or 0 for the default size
+ *
+ * Stack sizes are rounded up to a power of two pages, at least one page.
+ *
+ * Return: Size of the stacks that uthread_ctx_alloc_stack() allocates for
+ * @size, or 0 if @size is too large
+ */
+size_t uthread_ctx_stack_size(size_t size);
+
 /*
  * uthread_ctx_alloc_stack - Allocate stack segment
+ * @size: Size of the stack, as returned by uthread_ctx_stack_size()
+ *
+ * Take a stack of that size from the stack pool, or map a new one (preceded by
+ * a guard page) if the pool has none.
  *
  * Return: Pointer to the top of a valid stack segment, or NULL in case of
  * failure
  */
-void *uthread_ctx_alloc_stack(void);
+void *uthread_ctx_alloc_stack(size_t size);
 
 /*
  * uthread_ctx_destroy_stack - Deallocate stack segment
  * @top_of_stack: Address of stack to deallocate
+ * @size: Size the stack was allocated with
+ *
+ * Return the stack to the stack pool. Must not be called by the thread running
+ * on that stack, which is why exiting threads have their stack released by the
+ * thread that runs after them.
+ */
+void uthread_ctx_destroy_stack(void *top_of_stack, size_t size);
+
+/*
+ * uthread_ctx_pool_start - Start the stack pool
+ *
+ * Reset the pool counters and map stacks until the pool reaches its low
+ * watermark.
+ *
+ * Return: 0 in case of success, -1 if a stack could not be mapped
+ */
+int uthread_ctx_pool_start(void);
+
+/*
+ * uthread_ctx_pool_stop - Stop the stack pool
+ *
+ * Unmap all the stacks cached in the pool.
  */
-void uthread_ctx_destroy_stack(void *top_of_stack);
+void uthread_ctx_pool_stop(void);
 
 /*
  * uthread_ctx_init - Initialize a thread's execution context
  * @uctx: Pointer to thread context to initialize
  * @top_of_stack: Pointer to the top of a valid stack segment, as allocated by
  *	uthread_ctx_alloc_stack()
+ * @size: Size of the stack segment
  * @func: Function to be executed by the thread
  * @arg: Argument to pass to the thread
  *
  * Return: 0 if @uctx was properly initialized, or -1 in case of failure
  */
-int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
+int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack, size_t size,
 					 uthread_func_t func, void *arg);
 
 
@@ -70,8 +134,8 @@ int uthread_ctx_init(uthread_ctx_t *uctx, void *top_of_stack,
  * preempt_start - Start thread preemption
  * @preempt: Enable preemption if true
  *
- * Configure a timer that must fire a virtual alarm at a frequency of 100 Hz and
- * setup a timer handler that forcefully yields the currently running thread.
+ * Setup a virtual alarm handler that forcefully yields the currently running
+ * thread. The alarms are fired by per-worker timers, see preempt_timer_start().
  *
  * If @preempt is false, don't start preemption; all the other functions from
  * the preemption API should then be ineffective.
@@ -81,32 +145,367 @@ void preempt_start(bool preempt);
 /*
  * preempt_stop - Stop thread preemption
  *
- * Restore previous timer configuration, and previous action associated to
- * virtual alarm signals.
+ * Restore the previous action associated to virtual alarm signals. Must be
+ * called once every worker has stopped its timer.
  */
 void preempt_stop(void);
 
+/*
+ * preempt_timer_start - Start the preemption timer of the calling worker
+ *
+ * Create a timer on the clock selected by uthread_preempt_config(), that sends
+ * a virtual alarm to the calling kernel thread only, once per quantum. Does
+ * nothing if preemption was not started.
+ */
+void preempt_timer_start(void);
+
+/*
+ * preempt_timer_stop - Stop the preemption timer of the calling worker
+ */
+void preempt_timer_stop(void);
+
 /*
  * preempt_enable - Enable preemption
+ *
+ * Calls to preempt_disable() and preempt_enable() nest: preemption is only
+ * enabled again by the preempt_enable() matching the outermost
+ * preempt_disable().
+ *
+ * If a timer tick arrived while preemption was disabled, the thread yields as
+ * soon as preemption is enabled again.
  */
 void preempt_enable(void);
 
 /*
  * preempt_disable - Disable preemption
+ *
+ * Only increments a per-kernel-thread counter, without masking the timer
+ * signal: a tick received while the counter is non-zero is deferred to the
+ * matching preempt_enable() instead of yielding.
  */
 void preempt_disable(void);
 
+/*
+ * preempt_save - Get the preemption disabling depth of the running thread
+ *
+ * The depth is kept per kernel thread. A user-level thread switching away
+ * saves its depth with preempt_save() and, once resumed, restores it with
+ * preempt_restore(), possibly on another kernel thread. Preemption is always
+ * disabled on both sides of a context switch.
+ *
+ * Return: Number of preempt_disable() calls not yet matched by a
+ * preempt_enable()
+ */
+unsigned int preempt_save(void);
+
+/*
+ * preempt_restore - Restore the preemption disabling depth
+ * @depth: Depth returned by preempt_save(), must not be 0
+ */
+void preempt_restore(unsigned int depth);
+
+
+/**
+ * Private I/O API
+ */
+
+/*
+ * io_start - Create the epoll instance of the scheduler
+ *
+ * Return: 0 in case of success, -1 in case of failure
+ */
+int io_start(void);
+
+/*
+ * io_stop - Close the epoll instance of the scheduler
+ *
+ * Must only be called once no thread is waiting for I/O anymore.
+ */
+void io_stop(void);
+
+/*
+ * io_pending - Check for threads waiting for I/O
+ *
+ * Such threads are held (see uthread_hold()) and only get unblocked by
+ * io_poll(), so some worker must poll while any is waiting.
+ *
+ * Return: true if some thread is blocked in uthread_read() and the like
+ */
+bool io_pending(void);
+
+/*
+ * io_poll - Poll for I/O
+ * @timeout: Maximum time to wait in nanoseconds, 0 to return immediately or
+ *	-1 to wait until some I/O completes or io_kick() is called
+ *
+ * Unblock the threads whose fd became ready, onto the calling worker's run
+ * queue. Must be called with preemption disabled.
+ *
+ * Return: Number of threads unblocked
+ */
+int io_poll(int64_t timeout);
+
+/*
+ * io_kick - Wake up the worker waiting in io_poll()
+ */
+void io_kick(void);
+
+/**
+ * Private io_uring API
+ */
+
+/*
+ * uring_start - Set up the io_uring of the scheduler
+ *
+ * Return: 0 in case of success, -1 if io_uring is unavailable, in which case
+ * file I/O is done with regular blocking system calls
+ */
+int uring_start(void);
+
+/*
+ * uring_stop - Tear the io_uring down
+ *
+ * Must only be called once no thread is waiting for file I/O anymore.
+ */
+void uring_stop(void);
+
+/*
+ * uring_fd - Get the io_uring fd
+ *
+ * The fd is readable whenever completions are available, so that it can be
+ * polled along with other fds.
+ *
+ * Return: io_uring fd, or -1 if not set up
+ */
+int uring_fd(void);
+
+/*
+ * uring_pending - Check for threads waiting for file I/O
+ *
+ * Return: true if some thread is blocked in uthread_pread() and the like
+ */
+bool uring_pending(void);
+
+/*
+ * uring_poll - Submit file I/O and reap completions
+ *
+ * File I/O requests are queued by their threads, which block right away, and
+ * only submitted by the next call to uring_poll(), all at once. Completed
+ * requests have their thread unblocked onto the calling worker's run queue.
+ * Never waits. Must be called with preemption disabled.
+ *
+ * Return: Number of threads unblocked
+ */
+int uring_poll(void);
+
+/**
+ * Private timer API
+ */
+
+/*
+ * uthread_timer - Timer
+ * @next: Link of the timing wheel slot the timer is in
+ * @prev: Link of the timing wheel slot the timer is in
+ * @expires: Tick at which the timer expires
+ * @level: Level of the timing wheel the timer is in
+ * @slot: Slot of the timing wheel the timer is in
+ * @state: Whether the timer is idle, pending or expiring
+ * @func: Function called when the timer expires
+ *
+ * Timers are usually embedded in a structure on the stack of a thread about to
+ * block, which @func unblocks.
+ */
+struct uthread_timer {
+	struct uthread_timer *next;
+	struct uthread_timer *prev;
+	uint64_t expires;
+	int level;
+	int slot;
+	atomic_int state;
+	void (*func)(struct uthread_timer *timer);
+};
+
+/*
+ * timer_now - Get the current time
+ *
+ * Return: Current CLOCK_MONOTONIC time in nanoseconds, the clock of all the
+ * timer deadlines
+ */
+uint64_t timer_now(void);
+
+/*
+ * timer_cycles - Get a cheap timestamp
+ *
+ * Meant for statistics and tracing on hot paths, where timer_now() would cost
+ * a system call's worth of time on some systems.
+ *
+ * Return: CPU cycle counter where available, timer_now() otherwise
+ */
+static inline uint64_t timer_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return timer_now();
+#endif
+}
+
+/*
+ * timer_start - Start the timing wheel
+ */
+void timer_start(void);
+
+/*
+ * timer_pending - Check for pending timers
+ *
+ * Return: true if some timer is pending
+ */
+bool timer_pending(void);
+
+/*
+ * timer_init - Initialize a timer
+ * @timer: Timer to initialize
+ * @func: Function to call when @timer expires
+ */
+void timer_init(struct uthread_timer *timer, void (*func)(struct uthread_timer *timer));
+
+/*
+ * timer_add - Arm a timer
+ * @timer: Timer to arm, must not be pending
+ * @deadline: Time at which @timer expires, as returned by timer_now()
+ *
+ * Timers expire at the first tick of the timing wheel after their deadline,
+ * never before.
+ *
+ * Return: 0 if @timer was armed, -1 if @deadline already passed
+ */
+int timer_add(struct uthread_timer *timer, uint64_t deadline);
+
+/*
+ * timer_cancel - Disarm a timer
+ * @timer: Timer to disarm
+ *
+ * If @timer is expiring on another worker, wait until its function returns.
+ * Either way, @timer can be reused or freed once timer_cancel() returns, which
+ * must be done even for timers that expired.
+ *
+ * Return: true if @timer was pending, false if it already expired
+ */
+bool timer_cancel(struct uthread_timer *timer);
+
+/*
+ * timer_expire - Expire timers
+ *
+ * Advance the timing wheel up to the current time and call the functions of
+ * the timers that expired. Costs O(1) amortized per timer. Must be called with
+ * preemption disabled and no spinlock held.
+ *
+ * Return: Number of timers that expired
+ */
+int timer_expire(void);
+
+/*
+ * timer_next - Get the next timer deadline
+ * @deadline: Filled with the time at which timer_expire() may have timers to
+ *	expire next, which can be earlier than the deadline of any timer
+ *
+ * Return: false if no timer is pending, true otherwise
+ */
+bool timer_next(uint64_t *deadline);
 
 /**
  * Private uthread API
  */
 
+/*
+ * uthread_spinlock_t - Spinlock
+ *
+ * Protects scheduler state shared between kernel worker threads (see
+ * uthread_run_workers()), such as run queues or semaphores. Spinlocks must
+ * only be taken with preemption disabled.
+ */
+typedef struct {
+	atomic_bool locked;
+} uthread_spinlock_t;
+
+/*
+ * uthread_spin_init - Initialize a spinlock in the unlocked state
+ * @lock: Spinlock to initialize
+ */
+void uthread_spin_init(uthread_spinlock_t *lock);
+
+/*
+ * uthread_spin_lock - Take a spinlock
+ * @lock: Spinlock to take
+ */
+void uthread_spin_lock(uthread_spinlock_t *lock);
+
+/*
+ * uthread_spin_unlock - Release a spinlock
+ * @lock: Spinlock to release
+ */
+void uthread_spin_unlock(uthread_spinlock_t *lock);
+
 /*
  * uthread_tcb - Internal representation of threads called TCB (Thread Control
  * Block)
  */
 struct uthread_tcb;
 
+/*
+ * uthread_list - Intrusive list of threads
+ * @head: Oldest thread of the list
+ * @tail: Newest thread of the list
+ * @length: Number of threads in the list
+ *
+ * Threads are linked through fields embedded in their TCB, so that adding or
+ * removing a thread never allocates memory. A thread can only be on one list
+ * at a time (e.g. the ready queue or the waiting list of a semaphore).
+ */
+struct uthread_list {
+	struct uthread_tcb *head;
+	struct uthread_tcb *tail;
+	int length;
+};
+
+/*
+ * uthread_list_init - Initialize an empty thread list
+ * @list: List to initialize
+ */
+void uthread_list_init(struct uthread_list *list);
+
+/*
+ * uthread_list_push - Append a thread to a list
+ * @list: List to append to
+ * @uthread: TCB of thread to append, must not be on any list
+ */
+void uthread_list_push(struct uthread_list *list, struct uthread_tcb *uthread);
+
+/*
+ * uthread_list_pop - Remove the oldest thread of a list
+ * @list: List to remove from
+ *
+ * Return: TCB of the removed thread, or NULL if @list is empty
+ */
+struct uthread_tcb *uthread_list_pop(struct uthread_list *list);
+
+/*
+ * uthread_list_remove - Remove a thread from a list
+ * @list: List @uthread is on
+ * @uthread: TCB of thread to remove
+ *
+ * This operation is O(1).
+ */
+void uthread_list_remove(struct uthread_list *list, struct uthread_tcb *uthread);
+
+/*
+ * uthread_list_splice - Move all the threads of a list to another
+ * @list: List to append to
+ * @from: List to move the threads from, left empty
+ *
+ * This operation is O(1).
+ */
+void uthread_list_splice(struct uthread_list *list, struct uthread_list *from);
+
 /*
  * uthread_current - Get currently running thread
  *
@@ -116,13 +515,392 @@ struct uthread_tcb *uthread_current(void);
 
 /*
  * uthread_block - Block currently running thread
+ * @lock: Spinlock to release once switched away, or NULL
+ *
+ * Block the currently running thread and switch to another thread. Must be
+ * called with preemption disabled.
+ *
+ * A thread typically puts itself on a waiting list before blocking, while
+ * holding the lock that protects this list. That lock is only released once the
+ * thread's context has been saved, so that a concurrent uthread_unblock() from
+ * another worker cannot resume it too early. The lock is not taken again when
+ * the thread is resumed.
  */
-void uthread_block(void);
+void uthread_block(uthread_spinlock_t *lock);
 
 /*
  * uthread_unblock - Unblock thread
  * @uthread: TCB of thread to unblock
+ *
+ * Make @uthread ready again, on the run queue of the calling worker (the
+ * waker), not of the worker it last ran on; idle workers may steal it from
+ * there. A high-priority thread takes the waker's run-next slot instead (see
+ * enum uthread_priority).
  */
 void uthread_unblock(struct uthread_tcb *uthread);
 
+/*
+ * uthread_unblock_all - Unblock a list of threads
+ * @list: List of the TCBs of threads to unblock, left empty
+ *
+ * Make all the threads of @list ready again at once: the whole list is moved
+ * to the shared overflow queue in one go, in order, and as many idle workers
+ * as needed are woken up to run them.
+ */
+void uthread_unblock_all(struct uthread_list *list);
+
+/*
+ * uthread_handoff - Unblock thread and switch to it
+ * @uthread: TCB of thread to unblock
+ *
+ * Make @uthread run right away on the calling worker, bypassing the run
+ * queues, while the currently running thread goes back to the ready state.
+ * Must be called with @uthread fully switched away, as for uthread_unblock().
+ * Outside of a thread (e.g. from a worker's idle loop), same as
+ * uthread_unblock().
+ */
+void uthread_handoff(struct uthread_tcb *uthread);
+
+/*
+ * uthread_hold - Keep the scheduler running for a blocked thread
+ *
+ * The scheduler stops once no thread is ready or running anymore. A thread
+ * about to block on an event that the scheduler itself delivers, such as I/O
+ * completion, calls uthread_hold() beforehand so that the scheduler keeps
+ * going until the event arrives. Each uthread_hold() must be matched by a
+ * uthread_release() once the thread is unblocked.
+ */
+void uthread_hold(void);
+
+/*
+ * uthread_release - Release a thread held by uthread_hold()
+ */
+void uthread_release(void);
+
+/*
+ * uthread_timer_add - Arm a timer that unblocks a thread
+ * @timer: Timer to arm, must not be pending
+ * @deadline: Time at which @timer expires, as returned by timer_now()
+ *
+ * Same as timer_add(), and also wakes up the worker polling for I/O if it is
+ * asleep past @deadline, so that @timer expires on time.
+ *
+ * Return: 0 if @timer was armed, -1 if @deadline already passed
+ */
+int uthread_timer_add(struct uthread_timer *timer, uint64_t deadline);
+
+/*
+ * uthread_id - Get the identifier of a thread, for tracing
+ * @uthread: TCB of the thread, or NULL
+ *
+ * Return: Number of the thread in creation order, starting at 1 for each run.
+ * 0 for NULL or a worker's idle loop.
+ */
+unsigned long uthread_id(struct uthread_tcb *uthread);
+
+/*
+ * uthread_preempt - Yield on a preemption tick
+ *
+ * Same as uthread_yield(), but counts the switch as involuntary.
+ */
+void uthread_preempt(void);
+
+/*
+ * uthread_start - Finish switching to a new thread
+ *
+ * Called by a new thread when it first runs, with preemption disabled, to
+ * complete the context switch that elected it.
+ */
+void uthread_start(void);
+
+/**
+ * Private wait queue API
+ */
+
+/*
+ * uthread_select - Thread blocked in uthread_select(), opaque
+ */
+struct uthread_select;
+
+/*
+ * uthread_waiter - Thread waiting on a semaphore or a channel
+ * @next: Next waiter of the queue
+ * @prev: Previous waiter of the queue
+ * @uthread: TCB of the waiting thread
+ * @select: Selection the waiter is one of the cases of, or NULL
+ * @index: Index of the case of @select
+ * @elem: Element to send, or where to copy the received element
+ * @count: Number of semaphore resources to hand over to the waiter
+ * @done: Set once the operation completed, left false by uthread_chan_close()
+ * @linked: Whether the waiter is on a queue
+ *
+ * Waiters live on the stack of their thread, which blocks until a waker takes
+ * its waiter off the queue with uthread_wait_claim(), completes the operation
+ * on its behalf and unblocks it with uthread_waiter_wake(). A thread blocked in
+ * uthread_select() has a waiter on the queue of each case, and only the first
+ * one claimed wakes it up.
+ */
+struct uthread_waiter {
+	struct uthread_waiter *next;
+	struct uthread_waiter *prev;
+	struct uthread_tcb *uthread;
+	struct uthread_select *select;
+	int index;
+	void *elem;
+	size_t count;
+	bool done;
+	bool linked;
+};
+
+/*
+ * uthread_wait_queue - FIFO of waiters
+ * @head: Oldest waiter of the queue
+ * @tail: Newest waiter of the queue
+ *
+ * Protected by the lock of the object it belongs to.
+ */
+struct uthread_wait_queue {
+	struct uthread_waiter *head;
+	struct uthread_waiter *tail;
+};
+
+/*
+ * uthread_wait_init - Initialize an empty wait queue
+ * @queue: Queue to initialize
+ */
+void uthread_wait_init(struct uthread_wait_queue *queue);
+
+/*
+ * uthread_waiter_init - Initialize the waiter of the currently running thread
+ * @waiter: Waiter to initialize, for a plain wait outside of a selection
+ * @elem: Element to send, or where to copy the received element
+ */
+void uthread_waiter_init(struct uthread_waiter *waiter, void *elem);
+
+/*
+ * uthread_wait_push - Append a waiter to a queue
+ * @queue: Queue to append to
+ * @waiter: Waiter to append
+ */
+void uthread_wait_push(struct uthread_wait_queue *queue, struct uthread_waiter *waiter);
+
+/*
+ * uthread_wait_remove - Remove a waiter from a queue, if still on it
+ * @queue: Queue @waiter was appended to
+ * @waiter: Waiter to remove
+ */
+void uthread_wait_remove(struct uthread_wait_queue *queue, struct uthread_waiter *waiter);
+
+/*
+ * uthread_waiter_claim - Claim a waiter already taken off its queue
+ * @waiter: Waiter to claim
+ *
+ * For wakers that look at a waiter before taking it, see uthread_wait_claim().
+ *
+ * Return: true if @waiter can be woken up, false if it is a case of a
+ * selection that another case woke up first
+ */
+bool uthread_waiter_claim(struct uthread_waiter *waiter);
+
+/*
+ * uthread_wait_claim - Take the next waiter to wake up off a queue
+ * @queue: Queue to take from
+ *
+ * Remove the oldest waiters of @queue until one can be woken up: either a
+ * plain waiter, or a case of a selection that no other case woke up first.
+ * Claiming a case is what makes its selection fire. The caller must then
+ * complete the operation of the claimed waiter, and wake it up once the lock
+ * protecting @queue is released.
+ *
+ * Return: Claimed waiter, or NULL if no waiter can be woken up
+ */
+struct uthread_waiter *uthread_wait_claim(struct uthread_wait_queue *queue);
+
+/*
+ * uthread_waiter_wake - Wake up a claimed waiter
+ * @waiter: Waiter returned by uthread_wait_claim()
+ * @handoff: Switch to its thread right away (see uthread_handoff())
+ *
+ * Must be called with preemption disabled and no spinlock held.
+ */
+void uthread_waiter_wake(struct uthread_waiter *waiter, bool handoff);
+
+/**
+ * Private semaphore API, used by uthread_select()
+ */
+
+/*
+ * sem_lock - Lock a semaphore against other workers
+ * @sem: Semaphore to lock
+ */
+void sem_lock(sem_t sem);
+
+/*
+ * sem_unlock - Unlock a semaphore
+ * @sem: Semaphore to unlock
+ */
+void sem_unlock(sem_t sem);
+
+/*
+ * sem_try_down_locked - Take a semaphore if available, with @sem locked
+ * @sem: Semaphore to take
+ *
+ * Return: true if @sem was taken
+ */
+bool sem_try_down_locked(sem_t sem);
+
+/*
+ * sem_wait_locked - Queue a waiter on a semaphore, with @sem locked
+ * @sem: Semaphore to wait on
+ * @waiter: Waiter to queue
+ */
+void sem_wait_locked(sem_t sem, struct uthread_waiter *waiter);
+
+/*
+ * sem_unwait_locked - Dequeue a waiter from a semaphore, with @sem locked
+ * @sem: Semaphore @waiter was queued on
+ * @waiter: Waiter to dequeue, if still queued
+ */
+void sem_unwait_locked(sem_t sem, struct uthread_waiter *waiter);
+
+/**
+ * Private channel API, used by uthread_select()
+ */
+
+/*
+ * chan_status - Outcome of a channel operation attempt
+ * @CHAN_NOT_READY: The operation would block
+ * @CHAN_DONE: The element was sent or received
+ * @CHAN_CLOSED: The channel is closed
+ */
+enum chan_status {
+	CHAN_NOT_READY,
+	CHAN_DONE,
+	CHAN_CLOSED,
+};
+
+/*
+ * chan_lock - Lock a channel against other workers
+ * @chan: Channel to lock
+ */
+void chan_lock(uthread_chan_t chan);
+
+/*
+ * chan_unlock - Unlock a channel
+ * @chan: Channel to unlock
+ */
+void chan_unlock(uthread_chan_t chan);
+
+/*
+ * chan_try_send_locked - Send an element if possible, with @chan locked
+ * @chan: Channel to send on
+ * @elem: Element to send
+ * @wake: Filled with the waiter to wake up once @chan is unlocked, or NULL
+ *
+ * Return: Outcome of the attempt
+ */
+enum chan_status chan_try_send_locked(uthread_chan_t chan, const void *elem,
+				      struct uthread_waiter **wake);
+
+/*
+ * chan_try_recv_locked - Receive an element if possible, with @chan locked
+ * @chan: Channel to receive from
+ * @elem: Where to copy the received element
+ * @wake: Filled with the waiter to wake up once @chan is unlocked, or NULL
+ *
+ * Return: Outcome of the attempt
+ */
+enum chan_status chan_try_recv_locked(uthread_chan_t chan, void *elem,
+				      struct uthread_waiter **wake);
+
+/*
+ * chan_wait_locked - Queue a waiter on a channel, with @chan locked
+ * @chan: Channel to wait on
+ * @waiter: Waiter to queue
+ * @send: Whether @waiter waits to send, or to receive
+ */
+void chan_wait_locked(uthread_chan_t chan, struct uthread_waiter *waiter, bool send);
+
+/*
+ * chan_unwait_locked - Dequeue a waiter from a channel, with @chan locked
+ * @chan: Channel @waiter was queued on
+ * @waiter: Waiter to dequeue, if still queued
+ * @send: Whether @waiter waits to send, or to receive
+ */
+void chan_unwait_locked(uthread_chan_t chan, struct uthread_waiter *waiter, bool send);
+
+/**
+ * Private trace API
+ */
+
+/*
+ * trace_type - Type of a trace event
+ * @TRACE_SWITCH: Worker switched from @thread to thread @arg (0 for its idle
+ *	loop)
+ * @TRACE_CREATE: Thread @thread was created by thread @arg
+ * @TRACE_EXIT: Thread @thread exited
+ * @TRACE_BLOCK: Thread @thread blocked
+ * @TRACE_UNBLOCK: Thread @thread was unblocked by thread @arg
+ * @TRACE_PREEMPT: Thread @thread got a preemption tick
+ * @TRACE_SEM_DOWN: Thread @thread takes semaphore @arg
+ * @TRACE_SEM_UP: Thread @thread releases semaphore @arg
+ */
+enum trace_type {
+	TRACE_SWITCH,
+	TRACE_CREATE,
+	TRACE_EXIT,
+	TRACE_BLOCK,
+	TRACE_UNBLOCK,
+	TRACE_PREEMPT,
+	TRACE_SEM_DOWN,
+	TRACE_SEM_UP,
+};
+
+/* Whether events are being recorded, see uthread_trace_start() */
+extern atomic_bool trace_enabled;
+
+/*
+ * trace_record - Record an event in the ring of the calling kernel thread
+ * @type: Type of the event
+ * @thread: Identifier of the thread the event is about
+ * @arg: Argument of the event, depending on @type
+ */
+void trace_record(enum trace_type type, unsigned long thread, uint64_t arg);
+
+/*
+ * trace_name - Record the name of a thread, to name its track in the trace
+ * @thread: Identifier of the thread
+ * @name: Name of the thread
+ *
+ * Only meant to be called while tracing is enabled. Names are kept in a table
+ * of as many entries as a ring has events, so a newer thread may take the
+ * entry of an older one, which then goes unnamed in the trace.
+ */
+void trace_name(unsigned long thread, const char *name);
+
+/*
+ * trace - Record an event if tracing is enabled
+ * @type: Type of the event
+ * @thread: Identifier of the thread the event is about
+ * @arg: Argument of the event, depending on @type
+ *
+ * Costs a single load and branch while tracing is disabled.
+ */
+static inline void trace(enum trace_type type, unsigned long thread, uint64_t arg) {
+	if (__builtin_expect(atomic_load_explicit(&trace_enabled, memory_order_relaxed), 0)) {
+		trace_record(type, thread, arg);
+	}
+}
+
+/*
+ * trace_current - Record an event about the calling thread if tracing is enabled
+ * @type: Type of the event
+ * @arg: Argument of the event, depending on @type
+ */
+static inline void trace_current(enum trace_type type, uint64_t arg) {
+	if (__builtin_expect(atomic_load_explicit(&trace_enabled, memory_order_relaxed), 0)) {
+		trace_record(type, uthread_id(uthread_current()), arg);
+	}
+}
+
 #endif /* _UTHREAD_PRIVATE_H */
@@ -4,17 +4,92 @@
 
 #include "queue.h"
 
+/* Size (and alignment) of the chunks nodes are carved out of */
+#define CHUNK_SIZE 4096
+
 typedef struct node {
 	void *data;
 	struct node *next;
+	struct node *prev;
 } node_t;
 
+/*
+ * Nodes are allocated from chunks owned by their queue. Chunks are aligned on
+ * their size, so the chunk a node belongs to is found by masking its address.
+ */
+typedef struct chunk {
+	struct chunk *next;
+	int used;
+} chunk_t;
+
+#define CHUNK_NODES ((CHUNK_SIZE - sizeof(chunk_t)) / sizeof(node_t))
+
 struct queue {
 	node_t *head;
 	node_t *tail;
 	int length;
+	node_t *free_nodes;
+	chunk_t *chunks;
+	// Bounded queues store their items in a ring buffer instead of nodes.
+	void **ring;
+	unsigned int mask;
+	unsigned int first;
 };
 
+/* Returns the chunk a node was carved out of */
+static chunk_t *node_chunk(node_t *node) {
+	return (chunk_t *)((uintptr_t)node & ~(uintptr_t)(CHUNK_SIZE - 1));
+}
+
+/* Takes a node from the queue's free list, growing it by a chunk if empty */
+static node_t *node_alloc(queue_t queue) {
+	if (queue->free_nodes == NULL) {
+		chunk_t *chunk = aligned_alloc(CHUNK_SIZE, CHUNK_SIZE);
+		if (chunk == NULL) {
+			return NULL;
+		}
+		chunk->used = 0;
+		chunk->next = queue->chunks;
+		queue->chunks = chunk;
+
+		// Thread all the nodes of the new chunk onto the free list.
+		node_t *nodes = (node_t *)(chunk + 1);
+		for (size_t i = 0; i < CHUNK_NODES; i++) {
+			nodes[i].next = queue->free_nodes;
+			queue->free_nodes = &nodes[i];
+		}
+	}
+
+	node_t *node = queue->free_nodes;
+	queue->free_nodes = node->next;
+	node_chunk(node)->used++;
+
+	return node;
+}
+
+/* Returns a node to the queue's free list */
+static void node_free(queue_t queue, node_t *node) {
+	node_chunk(node)->used--;
+	node->next = queue->free_nodes;
+	queue->free_nodes = node;
+}
+
+/* Unlinks a node from the queue's list in O(1) and releases it */
+static void node_unlink(queue_t queue, node_t *node) {
+	if (node->prev == NULL) {
+		queue->head = node->next;
+	} else {
+		node->prev->next = node->next;
+	}
+	if (node->next == NULL) {
+		queue->tail = node->prev;
+	} else {
+		node->next->prev = node->prev;
+	}
+	node_free(queue, node);
+	queue->length--;
+}
+
 queue_t queue_create(void) {
 	// Allocating space for the queue structure.
 	queue_t q = malloc(sizeof(*q));
@@ -25,28 +100,121 @@ queue_t queue_create(void) {
 	q->head = NULL;
 	q->tail = NULL;
 	q->length = 0;
+	q->free_nodes = NULL;
+	q->chunks = NULL;
+	q->ring = NULL;
+	q->mask = 0;
+	q->first = 0;
 
 	return q;
 }
 
+queue_t queue_create_bounded(unsigned int capacity) {
+	// Capacity is rounded up to a power of two, so indices wrap with a mask.
+	if (capacity == 0 || capacity > (1U << 30)) {
+		return NULL;
+	}
+	unsigned int size = 1;
+	while (size < capacity) {
+		size <<= 1;
+	}
+
+	queue_t q = queue_create();
+	if (q == NULL) {
+		return NULL;
+	}
+	q->ring = malloc(size * sizeof(*q->ring));
+	if (q->ring == NULL) {
+		free(q);
+		return NULL;
+	}
+	q->mask = size - 1;
+
+	return q;
+}
+
+/* Returns address of the slot holding the item at position @i from the oldest */
+static void **ring_slot(queue_t queue, unsigned int i) {
+	return &queue->ring[(queue->first + i) & queue->mask];
+}
+
+/* Removes the item at position @i, shifting the newer items down by one */
+static void ring_remove(queue_t queue, unsigned int i) {
+	for (; i + 1 < (unsigned int)queue->length; i++) {
+		*ring_slot(queue, i) = *ring_slot(queue, i + 1);
+	}
+	queue->length--;
+}
+
 int queue_destroy(queue_t queue) {
 	// If queue is NULL/empty, return.
 	if (queue == NULL || queue->length > 0) {
 		return -1;
 	}
-	// Free memory for queue itself.
+	// Free node chunks or ring, then memory for queue itself.
+	queue_shrink(queue);
+	free(queue->ring);
 	free(queue);
 	return 0;
 }
 
+/* Releases the chunks none of the queued items live in */
+int queue_shrink(queue_t queue) {
+	if (queue == NULL) {
+		return -1;
+	}
+
+	// Unlink the free nodes that belong to unused chunks.
+	node_t **link = &queue->free_nodes;
+	while (*link != NULL) {
+		if (node_chunk(*link)->used == 0) {
+			*link = (*link)->next;
+		} else {
+			link = &(*link)->next;
+		}
+	}
+
+	// Unused chunks are now unreferenced and can be freed.
+	chunk_t **chunk = &queue->chunks;
+	while (*chunk != NULL) {
+		chunk_t *curr = *chunk;
+		if (curr->used == 0) {
+			*chunk = curr->next;
+			free(curr);
+		} else {
+			chunk = &curr->next;
+		}
+	}
+	return 0;
+}
+
 int queue_enqueue(queue_t queue, void *data) {
 	// If queue or data are NULL/empty, return.
 	if (queue == NULL || data == NULL) {
 		return -1;
 	}
 
-	// Allocate memory for the new node. If it is empty, return.
-	node_t *new_node = malloc(sizeof(node_t));
+	// Bounded queues fail right away when full.
+	if (queue->ring != NULL) {
+		if ((unsigned int)queue->length > queue->mask) {
+			return -1;
+		}
+		*ring_slot(queue, queue->length) = data;
+		queue->length++;
+		return 0;
+	}
+
+	return queue_enqueue_handle(queue, data, NULL);
+}
+
+int queue_enqueue_handle(queue_t queue, void *data, queue_handle_t *handle) {
+	// If queue or data are NULL/empty, return. Bounded queues have no handles.
+	if (queue == NULL || data == NULL || queue->ring != NULL) {
+		return -1;
+	}
+
+	// Take a node from the queue's chunks. If none can be allocated, return.
+	node_t *new_node = node_alloc(queue);
 	if (new_node == NULL) {
 		return -1;
 	}
@@ -54,6 +222,7 @@ int queue_enqueue(queue_t queue, void *data) {
 	// Fills new node with data
 	new_node->data = data;
 	new_node->next = NULL;
+	new_node->prev = queue->tail;
 
 	if (queue->tail == NULL) {
 		queue->head = new_node;
@@ -64,6 +233,9 @@ int queue_enqueue(queue_t queue, void *data) {
 	}
 
 	queue->length++;
+	if (handle != NULL) {
+		*handle = new_node;
+	}
 	return 0;
 }
 
@@ -74,6 +246,13 @@ int queue_dequeue(queue_t queue, void **data) {
 		return -1;
 	}
 
+	if (queue->ring != NULL) {
+		*data = *ring_slot(queue, 0);
+		queue->first = (queue->first + 1) & queue->mask;
+		queue->length--;
+		return 0;
+	}
+
 	// If queue does not have a head, return.
 	if (queue->head == NULL) {
 		*data = NULL;
@@ -83,15 +262,8 @@ int queue_dequeue(queue_t queue, void **data) {
 	node_t *old_head = queue->head;
 	*data = old_head->data;
 
-	// Sets head as next in queue.
-	queue->head = old_head->next;
-	if (queue->head == NULL) {
-		queue->tail = NULL;
-	}
-	
-	// Clears data from dequeued head from memory.
-	free(old_head);
-	queue->length--;
+	// Sets head as next in queue and returns dequeued head to the free nodes.
+	node_unlink(queue, old_head);
 
 	return 0;
 }
@@ -102,40 +274,54 @@ int queue_delete(queue_t queue, void *data) {
 	if (queue == NULL || data == NULL) {
 		return -1;
 	}
-	
-	node_t *curr = queue->head;
-	node_t *prev = NULL;
 
-	// Iterate through list while nodes remain.
-	while (curr != NULL) {
-		if (curr->data == data) {
-			// If head is a match, simply set next node as head and free its memory.
-			if (prev == NULL) {
-				queue->head = curr->next;
-			} else {
-				prev->next = curr->next;
+	if (queue->ring != NULL) {
+		for (unsigned int i = 0; i < (unsigned int)queue->length; i++) {
+			if (*ring_slot(queue, i) == data) {
+				ring_remove(queue, i);
+				return 0;
 			}
-			// If tail is a match, set the previous node as tail and free its memory.
-			if (curr == queue->tail) {
-				queue->tail = prev;
-			}
-			// Frees memory for current (deleted) node and decrements length.
-			free(curr);
-			queue->length--;
+		}
+		return -1;
+	}
+	
+	// Iterate through list while nodes remain, unlinking the first match.
+	for (node_t *curr = queue->head; curr != NULL; curr = curr->next) {
+		if (curr->data == data) {
+			node_unlink(queue, curr);
 			return 0;
 		}
-		// Continues through list.
-		prev = curr;
-		curr = curr->next;
 	}
 	return -1;
 }
 
+/* Deletes the node behind a handle, without searching the list */
+int queue_delete_handle(queue_t queue, queue_handle_t handle) {
+	if (queue == NULL || handle == NULL || queue->ring != NULL) {
+		return -1;
+	}
+	node_unlink(queue, handle);
+	return 0;
+}
+
 /* Provides a generic way to call a custom function on each item currently enqueued in the queue */
 int queue_iterate(queue_t queue, queue_func_t func) {
 	if (queue == NULL || func == NULL) {
 		return -1;
 	}
+	// Iterate through ring in place, only moving on if the current item is still there.
+	if (queue->ring != NULL) {
+		unsigned int i = 0;
+		while (i < (unsigned int)queue->length) {
+			void *data = *ring_slot(queue, i);
+			func(queue, data);
+			if (i < (unsigned int)queue->length && *ring_slot(queue, i) == data) {
+				i++;
+			}
+		}
+		return 0;
+	}
+
 	// Iterate through list and apply function to each node.
 	node_t *curr = queue->head;
 	while (curr != NULL) {
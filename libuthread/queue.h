@@ -12,6 +12,15 @@
  */
 typedef struct queue* queue_t;
 
+/*
+ * queue_handle_t - Queue item handle
+ *
+ * A handle designates one item of a queue, as returned by
+ * queue_enqueue_handle(). It remains valid until the item is dequeued or
+ * deleted, and must not be used afterwards.
+ */
+typedef struct node* queue_handle_t;
+
 /*
  * queue_create - Allocate an empty queue
  *
@@ -22,6 +31,21 @@ typedef struct queue* queue_t;
  */
 queue_t queue_create(void);
 
+/*
+ * queue_create_bounded - Allocate an empty bounded queue
+ * @capacity: Maximum number of items
+ *
+ * Create a queue which stores its items in a contiguous ring buffer of
+ * @capacity entries, rounded up to the next power of two. A bounded queue
+ * never allocates memory after its creation, and queue_enqueue() fails right
+ * away when it is full. All the other queue operations behave as they do on a
+ * regular queue.
+ *
+ * Return: Pointer to new empty queue. NULL if @capacity is 0 or larger than
+ * 2^30, or in case of failure when allocating the new queue.
+ */
+queue_t queue_create_bounded(unsigned int capacity);
+
 /*
  * queue_destroy - Deallocate a queue
  * @queue: Queue to deallocate
@@ -33,6 +57,19 @@ queue_t queue_create(void);
  */
 int queue_destroy(queue_t queue);
 
+/*
+ * queue_shrink - Release unused memory
+ * @queue: Queue to shrink
+ *
+ * Queue nodes are allocated in chunks which are kept by the queue once the
+ * items they held have been dequeued, so that later enqueues do not need to
+ * allocate memory. This function releases all the chunks that do not currently
+ * hold any item.
+ *
+ * Return: -1 if @queue is NULL. 0 otherwise.
+ */
+int queue_shrink(queue_t queue);
+
 /*
  * queue_enqueue - Enqueue data item
  * @queue: Queue in which to enqueue item
@@ -40,11 +77,28 @@ int queue_destroy(queue_t queue);
  *
  * Enqueue the address contained in @data in the queue @queue.
  *
- * Return: -1 if @queue or @data are NULL, or in case of memory allocation error
- * when enqueing. 0 if @data was successfully enqueued in @queue.
+ * Return: -1 if @queue or @data are NULL, in case of memory allocation error
+ * when enqueing, or if @queue is a bounded queue which is full. 0 if @data was
+ * successfully enqueued in @queue.
  */
 int queue_enqueue(queue_t queue, void *data);
 
+/*
+ * queue_enqueue_handle - Enqueue data item and get its handle
+ * @queue: Queue in which to enqueue item
+ * @data: Address of data item to enqueue
+ * @handle: Address of handle where the item's handle is received, may be NULL
+ *
+ * Enqueue the address contained in @data in the queue @queue, like
+ * queue_enqueue(), and return a handle to the new item in @handle. The handle
+ * can later be passed to queue_delete_handle() to delete the item in O(1).
+ *
+ * Return: -1 if @queue or @data are NULL, if @queue is a bounded queue, or in
+ * case of memory allocation error when enqueing. 0 if @data was successfully
+ * enqueued in @queue.
+ */
+int queue_enqueue_handle(queue_t queue, void *data, queue_handle_t *handle);
+
 /*
  * queue_dequeue - Dequeue data item
  * @queue: Queue in which to dequeue item
@@ -71,6 +125,19 @@ int queue_dequeue(queue_t queue, void **data);
  */
 int queue_delete(queue_t queue, void *data);
 
+/*
+ * queue_delete_handle - Delete data item by handle
+ * @queue: Queue in which to delete item
+ * @handle: Handle of the item to delete, as returned by queue_enqueue_handle()
+ *
+ * Delete the item designated by @handle from queue @queue. Unlike
+ * queue_delete(), this does not need to search the queue and is O(1).
+ *
+ * Return: -1 if @queue or @handle are NULL, or if @queue is a bounded queue. 0
+ * if the item was deleted from @queue.
+ */
+int queue_delete_handle(queue_t queue, queue_handle_t handle);
+
 /*
  * queue_func_t - Queue callback function type
  * @queue: Queue to which item belongs
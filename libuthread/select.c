@@ -0,0 +1,290 @@
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "private.h"
+#include "select.h"
+
+/* Thread blocked in uthread_select(), lives on its stack */
+struct uthread_select {
+	struct uthread_timer timer;	// First, so that the timer function finds the selection
+	atomic_int fired;	// Index of the case that fired, -1 until one does
+	uthread_spinlock_t lock;	// Held until the selecting thread has switched away
+	struct uthread_tcb *uthread;
+	int timeout;	// Index of the earliest timeout case, -1 if none
+};
+
+/* Semaphore or channel of a selection */
+struct select_object {
+	void *object;
+	bool chan;
+};
+
+/* Makes the selection of a waiter fire, unless another case did first; true if it did */
+bool uthread_waiter_claim(struct uthread_waiter *waiter) {
+	int none = -1;
+
+	if (waiter->select == NULL) {
+		return true;
+	}
+	return atomic_compare_exchange_strong(&waiter->select->fired, &none, waiter->index);
+}
+
+/* Takes the oldest waiter that can be woken up off a queue, NULL if none */
+struct uthread_waiter *uthread_wait_claim(struct uthread_wait_queue *queue) {
+	struct uthread_waiter *waiter;
+
+	while ((waiter = queue->head) != NULL) {
+		uthread_wait_remove(queue, waiter);
+		if (uthread_waiter_claim(waiter)) {
+			return waiter;
+		}
+		// Another case of its selection fired first, it only had to be dropped
+	}
+	return NULL;
+}
+
+/* Unblocks the thread of a claimed waiter */
+void uthread_waiter_wake(struct uthread_waiter *waiter, bool handoff) {
+	struct uthread_tcb *uthread = waiter->uthread;
+
+	// A selecting thread may still be queuing its other waiters, wait until it switched away
+	if (waiter->select != NULL) {
+		uthread_spin_lock(&waiter->select->lock);
+		uthread_spin_unlock(&waiter->select->lock);
+	}
+	if (handoff) {
+		uthread_handoff(uthread);
+	} else {
+		uthread_unblock(uthread);
+	}
+}
+
+/* Wakes up a selecting thread whose earliest timeout passed */
+static void select_timeout(struct uthread_timer *timer) {
+	struct uthread_select *select = (struct uthread_select *)timer;
+	int none = -1;
+
+	if (!atomic_compare_exchange_strong(&select->fired, &none, select->timeout)) {
+		return;
+	}
+	uthread_spin_lock(&select->lock);
+	uthread_spin_unlock(&select->lock);
+	uthread_unblock(select->uthread);
+}
+
+/* Adds an object to the set of a selection, kept in address order */
+static void objects_add(struct select_object *objects, int *count, void *object, bool chan) {
+	int i = *count;
+
+	for (int j = 0; j < *count; j++) {
+		if (objects[j].object == object) {
+			return;
+		}
+	}
+	// Insertion sort, so that all selections lock objects in the same order
+	while (i > 0 && (uintptr_t)objects[i - 1].object > (uintptr_t)object) {
+		objects[i] = objects[i - 1];
+		i--;
+	}
+	objects[i].object = object;
+	objects[i].chan = chan;
+	(*count)++;
+}
+
+/* Locks all the objects of a selection */
+static void objects_lock(struct select_object *objects, int count) {
+	for (int i = 0; i < count; i++) {
+		if (objects[i].chan) {
+			chan_lock(objects[i].object);
+		} else {
+			sem_lock(objects[i].object);
+		}
+	}
+}
+
+/* Unlocks all the objects of a selection */
+static void objects_unlock(struct select_object *objects, int count) {
+	for (int i = count - 1; i >= 0; i--) {
+		if (objects[i].chan) {
+			chan_unlock(objects[i].object);
+		} else {
+			sem_unlock(objects[i].object);
+		}
+	}
+}
+
+/* Performs the operation of a case if it can complete, with its object locked */
+static bool case_try(struct uthread_select_case *c, struct uthread_waiter **wake) {
+	enum chan_status status;
+
+	*wake = NULL;
+	switch (c->type) {
+	case UTHREAD_SELECT_SEM:
+		if (!sem_try_down_locked(c->sem)) {
+			return false;
+		}
+		c->result = 0;
+		return true;
+	case UTHREAD_SELECT_SEND:
+		status = chan_try_send_locked(c->chan, c->elem, wake);
+		break;
+	case UTHREAD_SELECT_RECV:
+		status = chan_try_recv_locked(c->chan, c->elem, wake);
+		break;
+	default:
+		return false;
+	}
+	if (status == CHAN_NOT_READY) {
+		return false;
+	}
+	c->result = status == CHAN_CLOSED ? -1 : 0;
+	return true;
+}
+
+/* Queues or dequeues the waiters of all the cases, with their objects locked */
+static void cases_wait(struct uthread_select_case *cases, struct uthread_waiter *waiters,
+		       size_t count, bool wait) {
+	for (size_t i = 0; i < count; i++) {
+		switch (cases[i].type) {
+		case UTHREAD_SELECT_SEM:
+			if (wait) {
+				sem_wait_locked(cases[i].sem, &waiters[i]);
+			} else {
+				sem_unwait_locked(cases[i].sem, &waiters[i]);
+			}
+			break;
+		case UTHREAD_SELECT_SEND:
+		case UTHREAD_SELECT_RECV:
+			if (wait) {
+				chan_wait_locked(cases[i].chan, &waiters[i],
+						 cases[i].type == UTHREAD_SELECT_SEND);
+			} else {
+				chan_unwait_locked(cases[i].chan, &waiters[i],
+						   cases[i].type == UTHREAD_SELECT_SEND);
+			}
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/* Blocks on several semaphores, channels and timeouts at once, until the first one fires */
+int uthread_select(struct uthread_select_case *cases, size_t count) {
+	struct uthread_select select;
+	struct uthread_waiter *wake;
+	int nr_objects = 0;
+	int fired = -1;
+
+	if (cases == NULL || count == 0 || count > UTHREAD_SELECT_MAX || uthread_current() == NULL) {
+		return -1;
+	}
+
+	struct select_object objects[count];
+	struct uthread_waiter waiters[count];
+
+	select.timeout = -1;
+	for (size_t i = 0; i < count; i++) {
+		switch (cases[i].type) {
+		case UTHREAD_SELECT_SEM:
+			if (cases[i].sem == NULL) {
+				return -1;
+			}
+			objects_add(objects, &nr_objects, cases[i].sem, false);
+			break;
+		case UTHREAD_SELECT_SEND:
+		case UTHREAD_SELECT_RECV:
+			if (cases[i].chan == NULL || cases[i].elem == NULL) {
+				return -1;
+			}
+			objects_add(objects, &nr_objects, cases[i].chan, true);
+			break;
+		case UTHREAD_SELECT_TIMEOUT:
+			if (select.timeout < 0 || cases[i].deadline < cases[select.timeout].deadline) {
+				select.timeout = i;
+			}
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	// Disable preemption while we change the semaphores and channels
+	preempt_disable();
+	// Holding all the locks, nobody can complete a case behind our back
+	objects_lock(objects, nr_objects);
+
+	// Performs the first operation that can complete right away, if any
+	for (size_t i = 0; i < count && fired < 0; i++) {
+		if (case_try(&cases[i], &wake)) {
+			fired = i;
+		}
+	}
+	if (fired < 0 && select.timeout >= 0 && cases[select.timeout].deadline <= timer_now()) {
+		fired = select.timeout;
+		cases[fired].result = 0;
+	}
+	if (fired >= 0) {
+		objects_unlock(objects, nr_objects);
+		if (wake != NULL) {
+			uthread_waiter_wake(wake, false);
+		}
+		preempt_enable();
+		return fired;
+	}
+
+	// Waits on every case at once
+	atomic_init(&select.fired, -1);
+	uthread_spin_init(&select.lock);
+	select.uthread = uthread_current();
+	for (size_t i = 0; i < count; i++) {
+		uthread_waiter_init(&waiters[i], cases[i].elem);
+		waiters[i].select = &select;
+		waiters[i].index = i;
+	}
+	cases_wait(cases, waiters, count, true);
+
+	// Wakers wait for this lock, which is only released once we have switched away
+	uthread_spin_lock(&select.lock);
+	if (select.timeout >= 0) {
+		timer_init(&select.timer, select_timeout);
+		if (uthread_timer_add(&select.timer, cases[select.timeout].deadline) < 0) {
+			// The deadline passed in the meantime, and no case could fire without our locks
+			uthread_spin_unlock(&select.lock);
+			cases_wait(cases, waiters, count, false);
+			objects_unlock(objects, nr_objects);
+			preempt_enable();
+			cases[select.timeout].result = 0;
+			return select.timeout;
+		}
+		// Held before no longer being runnable, so that the scheduler keeps going
+		uthread_hold();
+	}
+	objects_unlock(objects, nr_objects);
+	uthread_block(&select.lock);
+
+	// Woken up by the first case that fired, its operation already completed
+	fired = atomic_load(&select.fired);
+	if (select.timeout >= 0) {
+		// The timer may still be returning from select_timeout() on another worker
+		timer_cancel(&select.timer);
+		uthread_release();
+	}
+
+	// Stops waiting on the other cases
+	objects_lock(objects, nr_objects);
+	cases_wait(cases, waiters, count, false);
+	objects_unlock(objects, nr_objects);
+
+	// Critical section complete, enable preemption
+	preempt_enable();
+
+	if (fired == select.timeout) {
+		cases[fired].result = 0;
+	} else {
+		cases[fired].result = waiters[fired].done ? 0 : -1;
+	}
+	return fired;
+}
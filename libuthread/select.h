@@ -0,0 +1,78 @@
+#ifndef _UTHREAD_SELECT_H
+#define _UTHREAD_SELECT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chan.h"
+#include "sem.h"
+
+/*
+ * Multi-way select
+ *
+ * uthread_select() blocks the calling thread on several operations at once,
+ * and performs the first one that can complete: taking a semaphore, sending
+ * on a channel, receiving from a channel, or reaching a deadline.
+ */
+
+/* Maximum number of cases of a single uthread_select() */
+#define UTHREAD_SELECT_MAX 64
+
+/*
+ * uthread_select_type - Operation of a select case
+ * @UTHREAD_SELECT_SEM: Take semaphore @sem, as sem_down()
+ * @UTHREAD_SELECT_SEND: Send @elem on channel @chan, as uthread_chan_send()
+ * @UTHREAD_SELECT_RECV: Receive from channel @chan into @elem, as
+ *	uthread_chan_recv()
+ * @UTHREAD_SELECT_TIMEOUT: Fire once @deadline passes, in nanoseconds on the
+ *	clock of uthread_clock_ns()
+ */
+enum uthread_select_type {
+	UTHREAD_SELECT_SEM,
+	UTHREAD_SELECT_SEND,
+	UTHREAD_SELECT_RECV,
+	UTHREAD_SELECT_TIMEOUT,
+};
+
+/*
+ * uthread_select_case - Select case
+ * @type: Operation of the case
+ * @sem: Semaphore of a UTHREAD_SELECT_SEM case
+ * @chan: Channel of a UTHREAD_SELECT_SEND or UTHREAD_SELECT_RECV case
+ * @elem: Element to send, or where to copy the received element
+ * @deadline: Deadline of a UTHREAD_SELECT_TIMEOUT case
+ * @result: Filled in for the case that fired: -1 if its channel was closed, 0
+ *	otherwise
+ */
+struct uthread_select_case {
+	enum uthread_select_type type;
+	sem_t sem;
+	uthread_chan_t chan;
+	void *elem;
+	uint64_t deadline;
+	int result;
+};
+
+/*
+ * uthread_select - Wait for the first of several operations
+ * @cases: Array of cases
+ * @count: Number of cases, up to UTHREAD_SELECT_MAX
+ *
+ * If some operations can complete right away, perform the first of them, in
+ * the order of @cases. Otherwise, block the calling thread until one of them
+ * can, and perform that one only: the thread waits on all the semaphores and
+ * channels at the same time, and as soon as one of them lets its operation
+ * complete, the thread stops waiting on the others.
+ *
+ * A closed channel makes its cases fire right away, with their result set to
+ * -1. Among several timeouts, only the earliest matters; a timeout whose
+ * deadline already passed fires unless another operation can complete right
+ * away, which turns uthread_select() into a non-blocking poll.
+ *
+ * Return: Index of the case that fired, or -1 if @cases is NULL, if @count is
+ * 0 or above UTHREAD_SELECT_MAX, if a case is invalid, or if called outside of
+ * uthread_run().
+ */
+int uthread_select(struct uthread_select_case *cases, size_t count);
+
+#endif /* _UTHREAD_SELECT_H */
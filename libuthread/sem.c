@@ -1,14 +1,18 @@
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
 
-#include "queue.h"
 #include "private.h"
+#include "select.h"
 #include "sem.h"
 
 // Initializing semaphore struct
 struct semaphore {
-	int internal_count;
-	queue_t blocked_threads;
+	uthread_spinlock_t lock;	// Protects the count and queue against other workers
+	size_t internal_count;
+	struct uthread_wait_queue blocked_threads;
+	bool handoff;	// Switch to the woken thread right away
 };
 
 /* Creates new semaphore and initializes internal values */
@@ -19,14 +23,10 @@ sem_t sem_create(size_t count) {
 	if (sem == NULL) {
 		return NULL; // If memory allocation fails, return NULL
 	}
+	uthread_spin_init(&sem->lock);
 	sem->internal_count = count; // Set internal sem count to count
-	sem->blocked_threads = queue_create(); // Creates queue for blocked threads
-	
-	// Check to see if blocked_threads queue failed to allocate space
-	if (sem->blocked_threads == NULL) {
-		free(sem); // Frees semaphore if failure is detected
-		return NULL;
-	}
+	uthread_wait_init(&sem->blocked_threads); // Initializes queue for blocked threads
+	sem->handoff = false;
 	// Returns created semaphore
 	return sem;
 }
@@ -34,12 +34,10 @@ sem_t sem_create(size_t count) {
 /* Destroys a semaphore if its queue is empty or it is NULL */
 int sem_destroy(sem_t sem) {
 	// Check if sem is NULL or queue is not empty
-	if (sem == NULL || queue_length(sem->blocked_threads) > 0) {
+	if (sem == NULL || sem->blocked_threads.head != NULL) {
 		return -1; // Failed to destroy semaphore because it is not empty
 	}
 
-	// Free memory allocated for the threads
-	queue_destroy(sem->blocked_threads);
 	sem->internal_count = 0;
 
 	// Free memory allocated for the semaphore
@@ -47,63 +45,187 @@ int sem_destroy(sem_t sem) {
 	return 0;
 }
 
+/* Hands resources over to the oldest waiters, as long as there are enough for the next one */
+static void sem_claim_locked(sem_t sem, struct uthread_wait_queue *woken) {
+	struct uthread_waiter *waiter;
+
+	while ((waiter = sem->blocked_threads.head) != NULL && waiter->count <= sem->internal_count) {
+		uthread_wait_remove(&sem->blocked_threads, waiter);
+		// Cases of selections that already fired are only dropped
+		if (!uthread_waiter_claim(waiter)) {
+			continue;
+		}
+		sem->internal_count -= waiter->count;
+		waiter->done = true;
+		uthread_wait_push(woken, waiter);
+	}
+}
+
+/* Takes resources if available and nobody waits before us, with the semaphore locked */
+static bool sem_take_locked(sem_t sem, size_t n) {
+	if (sem->blocked_threads.head != NULL || sem->internal_count < n) {
+		return false;
+	}
+	sem->internal_count -= n;
+	return true;
+}
+
 int sem_down(sem_t sem) {
-	struct uthread_tcb *curr = uthread_current();
+	return sem_down_n(sem, 1);
+}
+
+/* Takes n resources at once; blocks until they are all available */
+int sem_down_n(sem_t sem, size_t n) {
+	struct uthread_waiter waiter;
 
 	// Check to make sure sem is not NULL
-    if (sem == NULL) {
+	if (sem == NULL) {
 		return -1;
 	}
+	if (n == 0) {
+		return 0;
+	}
+
+	trace_current(TRACE_SEM_DOWN, (uintptr_t)sem);
 
 	// Disable preemption while we change sem counts and queues
 	preempt_disable();
+	uthread_spin_lock(&sem->lock);
+
+	if (!sem_take_locked(sem, n)) {
+		// If not enough resources are available, block it and yield
+		uthread_waiter_init(&waiter, NULL);
+		waiter.count = n;
+		uthread_wait_push(&sem->blocked_threads, &waiter);
+		// The lock is only released once we have switched away
+		uthread_block(&sem->lock);
+		// Woken up by sem_up_n(), which handed us all the resources directly
+	} else {
+		uthread_spin_unlock(&sem->lock);
+	}
 
-	// Wait for resources to become available
-	while (sem->internal_count == 0) {
-		// If thread tries to use sem_down when no resources are available, block it and yield
-		queue_enqueue(sem->blocked_threads, curr);
-		uthread_block();
+	// Critical section complete, enable preemption
+	preempt_enable();
+
+	return 0;
+}
 
-		// Critical section complete, enable preemption
-		preempt_enable();
+/* Takes a semaphore only if a resource is available right away */
+int sem_trydown(sem_t sem) {
+	bool taken;
 
-		uthread_yield();
+	// Check to make sure sem is not NULL
+	if (sem == NULL) {
+		return -1;
 	}
 
-	// Disable preemption while we change sem counts and queues
+	// Disable preemption while we change sem counts
 	preempt_disable();
-	
-	// Decrement internal count of resources when done waiting
-	sem->internal_count--;
-	
+	uthread_spin_lock(&sem->lock);
+	taken = sem_take_locked(sem, 1);
+	uthread_spin_unlock(&sem->lock);
 	// Critical section complete, enable preemption
 	preempt_enable();
 
-    return 0;
+	return taken ? 0 : -1;
+}
+
+/* Takes a semaphore, giving up after ns nanoseconds */
+int sem_timeddown(sem_t sem, uint64_t ns) {
+	struct uthread_select_case cases[2];
+
+	// Check to make sure sem is not NULL
+	if (sem == NULL) {
+		return -1;
+	}
+
+	// Waits on the semaphore and a timeout at once, the timeout dequeuing our waiter
+	cases[0].type = UTHREAD_SELECT_SEM;
+	cases[0].sem = sem;
+	cases[1].type = UTHREAD_SELECT_TIMEOUT;
+	cases[1].deadline = timer_now() + ns;
+	return uthread_select(cases, 2) == 0 ? 0 : -1;
+}
+
+/* Switches sem_up() to handing the resource over and switching to the woken thread at once */
+int sem_set_handoff(sem_t sem, bool handoff) {
+	if (sem == NULL) {
+		return -1;
+	}
+	sem->handoff = handoff;
+	return 0;
 }
 
 /* Releases a semaphore; unblocks next thread in blocked queue, increases internal count */
 int sem_up(sem_t sem) {
+	return sem_up_n(sem, 1);
+}
+
+/* Releases n resources at once; unblocks as many threads in blocked queue as they satisfy */
+int sem_up_n(sem_t sem, size_t n) {
+	struct uthread_wait_queue woken;
+	struct uthread_waiter *waiter;
+
 	// Check to make sure sem is not NULL
 	if (sem == NULL) {
 		return -1;
 	}
+	if (n == 0) {
+		return 0;
+	}
+
+	trace_current(TRACE_SEM_UP, (uintptr_t)sem);
 
 	// Disable preemption while we change sem counts and queues
 	preempt_disable();
-
-	// Increment internal count of sem when resources are available
-	sem->internal_count++;
-	
-	// Dequeues next blocked thread when resources become available
-	struct uthread_tcb *next_thread_tcb;
-	if (queue_dequeue(sem->blocked_threads, (void**)&next_thread_tcb) == 0) {
-		uthread_unblock(next_thread_tcb);
-		uthread_yield(); // Yielding for fairness
+	uthread_spin_lock(&sem->lock);
+
+	// Dequeues blocked threads, which take their resources without them staying in the count
+	sem->internal_count += n;
+	uthread_wait_init(&woken);
+	sem_claim_locked(sem, &woken);
+	bool handoff = sem->handoff;
+	uthread_spin_unlock(&sem->lock);
+
+	if (woken.head != NULL) {
+		while ((waiter = woken.head) != NULL) {
+			// Their waiter is on their stack, not to be touched once they are unblocked
+			uthread_wait_remove(&woken, waiter);
+			// Runs the last one right away in handoff mode
+			uthread_waiter_wake(waiter, handoff && woken.head == NULL);
+		}
+		if (!handoff) {
+			uthread_yield(); // Yielding for fairness, once for the whole batch
+		}
 	}
 
 	// Critical section complete, enable preemption
 	preempt_enable();
 
 	return 0;
-}
\ No newline at end of file
+}
+
+/* Locks a semaphore, for uthread_select() */
+void sem_lock(sem_t sem) {
+	uthread_spin_lock(&sem->lock);
+}
+
+/* Unlocks a semaphore */
+void sem_unlock(sem_t sem) {
+	uthread_spin_unlock(&sem->lock);
+}
+
+/* Takes a resource if one is available, with the semaphore locked */
+bool sem_try_down_locked(sem_t sem) {
+	return sem_take_locked(sem, 1);
+}
+
+/* Queues a waiter for the next resource, with the semaphore locked */
+void sem_wait_locked(sem_t sem, struct uthread_waiter *waiter) {
+	uthread_wait_push(&sem->blocked_threads, waiter);
+}
+
+/* Dequeues a waiter that got no resource, with the semaphore locked */
+void sem_unwait_locked(sem_t sem, struct uthread_waiter *waiter) {
+	uthread_wait_remove(&sem->blocked_threads, waiter);
+}
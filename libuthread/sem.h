@@ -1,6 +1,7 @@
 #ifndef _SEMAPHORE_H
 #define _SEMAPHORE_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <sys/types.h>
 
@@ -50,6 +51,50 @@ int sem_destroy(sem_t sem);
  */
 int sem_down(sem_t sem);
 
+/*
+ * sem_down_n - Take several resources of a semaphore at once
+ * @sem: Semaphore to take
+ * @n: Number of resources to take
+ *
+ * Take @n resources from semaphore @sem atomically: the caller thread is
+ * blocked until all of them are available, and never holds only some of them.
+ * Threads are served in order, so that a thread taking many resources is not
+ * overtaken forever by threads taking fewer.
+ *
+ * Return: -1 if @sem is NULL. 0 if the resources were successfully taken,
+ * which is immediate if @n is 0.
+ */
+int sem_down_n(sem_t sem, size_t n);
+
+/*
+ * sem_trydown - Take a semaphore without blocking
+ * @sem: Semaphore to take
+ *
+ * Take a resource from semaphore @sem only if one is available right away and
+ * no other thread is waiting for it.
+ *
+ * Return: -1 if @sem is NULL or unavailable. 0 if semaphore was successfully
+ * taken.
+ */
+int sem_trydown(sem_t sem);
+
+/*
+ * sem_timeddown - Take a semaphore, waiting for a bounded time
+ * @sem: Semaphore to take
+ * @ns: Maximum waiting time, in nanoseconds
+ *
+ * Same as sem_down(), except that the caller thread gives up once @ns
+ * nanoseconds have passed without @sem becoming available: it leaves the
+ * waiting list of @sem and the call fails. With @ns 0, it only takes a
+ * resource that is available right away, like sem_trydown().
+ *
+ * Must be called from a thread run by the library.
+ *
+ * Return: -1 if @sem is NULL, if the wait timed out, or if called outside of
+ * uthread_run(). 0 if semaphore was successfully taken.
+ */
+int sem_timeddown(sem_t sem, uint64_t ns);
+
 /*
  * sem_up - Release a semaphore
  * @sem: Semaphore to release
@@ -58,10 +103,39 @@ int sem_down(sem_t sem);
  *
  * If the waiting list associated to @sem is not empty, releasing a resource
  * also causes the first thread (i.e. the oldest) in the waiting list to be
- * unblocked.
+ * unblocked. The resource is handed over to that thread directly, so that no
+ * other thread can take it in the meantime.
  *
  * Return: -1 if @sem is NULL. 0 if semaphore was successfully released.
  */
 int sem_up(sem_t sem);
 
+/*
+ * sem_up_n - Release several resources of a semaphore at once
+ * @sem: Semaphore to release
+ * @n: Number of resources to release
+ *
+ * Release @n resources to semaphore @sem, handing them over to as many threads
+ * of the waiting list as they satisfy, oldest first. All of them are unblocked
+ * in one pass, the caller thread yielding at most once for the whole batch (or,
+ * in handoff mode, switching to the last one unblocked).
+ *
+ * Return: -1 if @sem is NULL. 0 if the resources were successfully released.
+ */
+int sem_up_n(sem_t sem, size_t n);
+
+/*
+ * sem_set_handoff - Set the wake-up mode of a semaphore
+ * @sem: Semaphore to configure
+ * @handoff: Handoff mode enable
+ *
+ * By default, sem_up() puts the thread it unblocks at the back of the run
+ * queue and yields. In handoff mode, it switches to that thread right away
+ * instead, the releasing thread going back to the run queue, so that the
+ * resource is used without waiting for every other ready thread to run first.
+ *
+ * Return: -1 if @sem is NULL, 0 otherwise.
+ */
+int sem_set_handoff(sem_t sem, bool handoff);
+
 #endif /* _SEMAPHORE_H */
@@ -0,0 +1,287 @@
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "private.h"
+
+/*
+ * Hierarchical timing wheel
+ *
+ * Time is divided in ticks of 2^TICK_SHIFT ns (about 65 us). Level 0 has one
+ * slot per tick for the next 64 ticks, level 1 one slot per 64 ticks for the
+ * next 64 * 64 ticks, and so on. Each time the wheel crosses the boundary of a
+ * slot of an upper level, the timers of that slot are cascaded down to the
+ * lower levels, so that timers are only ever touched once per level. Timers
+ * further away than the top level can reach are parked in its farthest slot
+ * and cascaded again. Per-level bitmaps of the occupied slots let the wheel
+ * skip over empty slots, so that catching up after a long idle period only
+ * costs as much as the timers it expires.
+ */
+#define TICK_SHIFT	16
+#define WHEEL_BITS	6
+#define WHEEL_SIZE	(1 << WHEEL_BITS)
+#define WHEEL_MASK	(WHEEL_SIZE - 1)
+#define WHEEL_LEVELS	4
+
+enum timer_state {
+	TIMER_IDLE,
+	TIMER_PENDING,
+	TIMER_FIRING,
+};
+
+static uthread_spinlock_t wheel_lock;
+static uint64_t wheel_now;	// Next tick to expire
+static uint64_t wheel_bitmap[WHEEL_LEVELS];
+static struct uthread_timer *wheel_slots[WHEEL_LEVELS][WHEEL_SIZE];
+static atomic_uint wheel_count;
+
+/* Returns the current time in ns, on the clock of all the deadlines */
+uint64_t timer_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Links a timer in the slot matching its expiry tick, with the wheel locked */
+static void wheel_insert(struct uthread_timer *timer) {
+	uint64_t delta = timer->expires - wheel_now;
+	uint64_t expires = timer->expires;
+	int level = 0;
+	int slot;
+
+	// Finds the lowest level whose range covers the expiry tick
+	while (level < WHEEL_LEVELS - 1 && delta >= (uint64_t)WHEEL_SIZE << (level * WHEEL_BITS)) {
+		level++;
+	}
+	// Parks timers out of range in the farthest slot of the top level
+	if (delta >= (uint64_t)WHEEL_SIZE << (level * WHEEL_BITS)) {
+		expires = wheel_now + ((uint64_t)WHEEL_MASK << (level * WHEEL_BITS));
+	}
+	slot = (expires >> (level * WHEEL_BITS)) & WHEEL_MASK;
+
+	timer->level = level;
+	timer->slot = slot;
+	timer->prev = NULL;
+	timer->next = wheel_slots[level][slot];
+	if (timer->next != NULL) {
+		timer->next->prev = timer;
+	}
+	wheel_slots[level][slot] = timer;
+	wheel_bitmap[level] |= 1ULL << slot;
+}
+
+/* Unlinks a timer from its slot, with the wheel locked */
+static void wheel_remove(struct uthread_timer *timer) {
+	if (timer->prev == NULL) {
+		wheel_slots[timer->level][timer->slot] = timer->next;
+	} else {
+		timer->prev->next = timer->next;
+	}
+	if (timer->next != NULL) {
+		timer->next->prev = timer->prev;
+	}
+	if (wheel_slots[timer->level][timer->slot] == NULL) {
+		wheel_bitmap[timer->level] &= ~(1ULL << timer->slot);
+	}
+}
+
+/* Takes all the timers of a slot, with the wheel locked */
+static struct uthread_timer *wheel_take(int level, int slot) {
+	struct uthread_timer *timers = wheel_slots[level][slot];
+
+	wheel_slots[level][slot] = NULL;
+	wheel_bitmap[level] &= ~(1ULL << slot);
+	return timers;
+}
+
+/*
+ * Returns the next tick at which something happens in the wheel: a level 0
+ * slot expires, or an upper level slot has to be cascaded. Never later than
+ * @limit.
+ */
+static uint64_t wheel_next_event(uint64_t limit) {
+	uint64_t next = limit;
+
+	for (int level = 0; level < WHEEL_LEVELS; level++) {
+		int shift = level * WHEEL_BITS;
+		uint64_t window = wheel_now >> shift;
+		int pos = window & WHEEL_MASK;
+		uint64_t bits = wheel_bitmap[level];
+
+		if (bits == 0) {
+			continue;
+		}
+		// Rotates the bitmap so that bit d stands for the slot d windows ahead
+		bits = (bits >> pos) | (pos ? bits << (WHEEL_SIZE - pos) : 0);
+		/*
+		 * Once the window of an upper level slot started, its timers were
+		 * cascaded, so its bit stands for the same slot a full turn ahead
+		 */
+		if (level > 0 && (wheel_now & ((1ULL << shift) - 1)) != 0) {
+			bits &= ~1ULL;
+			if (bits == 0) {
+				// Only the slot of the current window, next visited a full turn later
+				bits = 1ULL << 63;
+				window += 1;
+			}
+		}
+		uint64_t tick = (window + __builtin_ctzll(bits)) << shift;
+
+		if (tick < next) {
+			next = tick;
+		}
+	}
+	return next;
+}
+
+/* Starts the timing wheel, empty */
+void timer_start(void) {
+	uthread_spin_init(&wheel_lock);
+	wheel_now = timer_now() >> TICK_SHIFT;
+	for (int level = 0; level < WHEEL_LEVELS; level++) {
+		wheel_bitmap[level] = 0;
+		for (int slot = 0; slot < WHEEL_SIZE; slot++) {
+			wheel_slots[level][slot] = NULL;
+		}
+	}
+	atomic_store(&wheel_count, 0);
+}
+
+/* Returns true if some timer is pending */
+bool timer_pending(void) {
+	return atomic_load(&wheel_count) > 0;
+}
+
+/* Initializes a timer calling @func when it expires */
+void timer_init(struct uthread_timer *timer, void (*func)(struct uthread_timer *timer)) {
+	timer->func = func;
+	atomic_init(&timer->state, TIMER_IDLE);
+}
+
+/* Arms a timer, -1 if its deadline already passed */
+int timer_add(struct uthread_timer *timer, uint64_t deadline) {
+	// Rounds up, so that timers never expire early
+	uint64_t expires = (deadline + (1ULL << TICK_SHIFT) - 1) >> TICK_SHIFT;
+
+	uthread_spin_lock(&wheel_lock);
+	// An empty wheel isn't kept up to date, catch up so as to use the lowest levels
+	if (atomic_load(&wheel_count) == 0) {
+		wheel_now = timer_now() >> TICK_SHIFT;
+	}
+	if (expires < wheel_now || deadline <= timer_now()) {
+		uthread_spin_unlock(&wheel_lock);
+		return -1;
+	}
+	timer->expires = expires;
+	wheel_insert(timer);
+	atomic_store(&timer->state, TIMER_PENDING);
+	atomic_fetch_add(&wheel_count, 1);
+	uthread_spin_unlock(&wheel_lock);
+	return 0;
+}
+
+/* Disarms a timer; false if it already expired, in which case its function has returned */
+bool timer_cancel(struct uthread_timer *timer) {
+	bool cancelled = false;
+
+	uthread_spin_lock(&wheel_lock);
+	if (atomic_load(&timer->state) == TIMER_PENDING) {
+		wheel_remove(timer);
+		atomic_store(&timer->state, TIMER_IDLE);
+		atomic_fetch_sub(&wheel_count, 1);
+		cancelled = true;
+	}
+	uthread_spin_unlock(&wheel_lock);
+
+	// Waits for the function to complete on whichever worker expired the timer
+	while (atomic_load_explicit(&timer->state, memory_order_acquire) == TIMER_FIRING) {
+		sched_yield();
+	}
+	return cancelled;
+}
+
+/* Expires the timers whose deadline passed and calls their function; returns how many */
+int timer_expire(void) {
+	struct uthread_timer *expired = NULL;
+	struct uthread_timer **tail = &expired;
+	struct uthread_timer *timer;
+	uint64_t now;
+	int count = 0;
+
+	if (atomic_load(&wheel_count) == 0) {
+		return 0;
+	}
+
+	now = timer_now() >> TICK_SHIFT;
+	uthread_spin_lock(&wheel_lock);
+	while (wheel_now <= now) {
+		uint64_t next = wheel_next_event(now + 1);
+
+		// Nothing left to do up to now, and new timers may expire right after
+		if (next > now) {
+			wheel_now = now + 1;
+			break;
+		}
+		wheel_now = next;
+
+		// Cascades the slots whose window starts now, from the top level down
+		for (int level = WHEEL_LEVELS - 1; level > 0; level--) {
+			int shift = level * WHEEL_BITS;
+
+			if ((wheel_now & ((1ULL << shift) - 1)) != 0) {
+				continue;
+			}
+			timer = wheel_take(level, (wheel_now >> shift) & WHEEL_MASK);
+			while (timer != NULL) {
+				struct uthread_timer *next = timer->next;
+
+				wheel_insert(timer);
+				timer = next;
+			}
+		}
+
+		// Every timer left in the level 0 slot expires now
+		timer = wheel_take(0, wheel_now & WHEEL_MASK);
+		while (timer != NULL) {
+			struct uthread_timer *next = timer->next;
+
+			atomic_store(&timer->state, TIMER_FIRING);
+			atomic_fetch_sub(&wheel_count, 1);
+			// Appended, so that the functions run in deadline order
+			timer->next = NULL;
+			*tail = timer;
+			tail = &timer->next;
+			timer = next;
+		}
+		wheel_now++;
+	}
+	uthread_spin_unlock(&wheel_lock);
+
+	while (expired != NULL) {
+		timer = expired;
+		expired = timer->next;
+		timer->func(timer);
+		atomic_store_explicit(&timer->state, TIMER_IDLE, memory_order_release);
+		count++;
+	}
+	return count;
+}
+
+/* Gets the time at which timer_expire() may have something to do next */
+bool timer_next(uint64_t *deadline) {
+	uint64_t tick;
+
+	if (atomic_load(&wheel_count) == 0) {
+		return false;
+	}
+	uthread_spin_lock(&wheel_lock);
+	tick = wheel_next_event(UINT64_MAX);
+	uthread_spin_unlock(&wheel_lock);
+
+	*deadline = tick << TICK_SHIFT;
+	return true;
+}
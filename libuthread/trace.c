@@ -0,0 +1,280 @@
+#include <inttypes.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "private.h"
+#include "trace.h"
+
+/* Recorded event, as small as possible to keep recording cheap */
+struct trace_event {
+	uint64_t time;	// timer_cycles() at recording
+	uint64_t arg;
+	uint32_t thread;
+	uint32_t type;
+};
+
+/* Events recorded by one kernel thread, the oldest overwritten first */
+struct trace_ring {
+	struct trace_ring *next;	// Link of the list of all the rings
+	size_t size;	// Size of the mapping
+	unsigned int index;	// Registration order, shown as the worker
+	uint64_t head;	// Number of events ever recorded
+	struct trace_event events[];
+};
+
+/* Name of a thread, recorded at its creation */
+struct trace_thread_name {
+	atomic_ulong thread;	// 0 while unused, ULONG_MAX while being written
+	char name[UTHREAD_NAME_MAX];
+};
+
+atomic_bool trace_enabled;
+
+// Rings of all the kernel threads that recorded events, newest first
+static struct trace_ring *_Atomic rings;
+static atomic_uint nr_rings;
+// Names of the named threads, indexed by identifier modulo @capacity
+static struct trace_thread_name *names;
+// Number of events of each ring, a power of two, 0 until tracing first starts
+static size_t capacity;
+// Start of the trace on both clocks, to convert cycles into nanoseconds
+static uint64_t epoch_cycles;
+static uint64_t epoch_ns;
+// Bumped when the rings are released, which drops the ones kernel threads hold on to
+static atomic_ulong generation;
+
+// Ring of the calling kernel thread, valid if registered in the current generation
+static __thread struct trace_ring *ring;
+static __thread unsigned long ring_generation;
+
+/* Gives the calling kernel thread a ring, 0 on success */
+static int ring_register(void) {
+	size_t size = sizeof(struct trace_ring) + capacity * sizeof(struct trace_event);
+	struct trace_ring *new;
+
+	// Mapped rather than allocated, as preemption ticks record events from a signal handler
+	new = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (new == MAP_FAILED) {
+		return -1;
+	}
+	new->size = size;
+	new->index = atomic_fetch_add(&nr_rings, 1);
+	new->head = 0;
+	new->next = atomic_load(&rings);
+	while (!atomic_compare_exchange_weak(&rings, &new->next, new));
+
+	ring = new;
+	ring_generation = atomic_load(&generation);
+	return 0;
+}
+
+/* Appends an event to the ring of the calling kernel thread */
+void trace_record(enum trace_type type, unsigned long thread, uint64_t arg) {
+	struct trace_event *event;
+
+	// The thread must neither be switched away nor migrate while writing into the ring
+	preempt_disable();
+	if ((ring != NULL && ring_generation == atomic_load(&generation)) || ring_register() == 0) {
+		event = &ring->events[ring->head & (capacity - 1)];
+		event->time = timer_cycles();
+		event->arg = arg;
+		event->thread = thread;
+		event->type = type;
+		ring->head++;
+	}
+	preempt_enable();
+}
+
+/*
+ * Records a thread name, in place of the name of an older thread with the same
+ * index. A ring holds at most @capacity events, so the table mostly loses names
+ * whose creation events are gone anyway. Dropped if the entry is being written.
+ */
+void trace_name(unsigned long thread, const char *name) {
+	struct trace_thread_name *entry;
+	unsigned long old;
+
+	if (names == NULL) {
+		return;
+	}
+	entry = &names[thread & (capacity - 1)];
+	old = atomic_load(&entry->thread);
+	if (old == ULONG_MAX || !atomic_compare_exchange_strong(&entry->thread, &old, ULONG_MAX)) {
+		return;
+	}
+	strcpy(entry->name, name);
+	atomic_store(&entry->thread, thread);
+}
+
+/* Returns the name recorded for a thread, NULL if none */
+static const char *thread_name(unsigned long thread) {
+	if (names == NULL || atomic_load(&names[thread & (capacity - 1)].thread) != thread) {
+		return NULL;
+	}
+	return names[thread & (capacity - 1)].name;
+}
+
+/* Writes a string as a JSON string literal */
+static void json_string(FILE *stream, const char *string) {
+	fputc('"', stream);
+	for (; *string != '\0'; string++) {
+		unsigned char c = *string;
+
+		if (c == '"' || c == '\\') {
+			fprintf(stream, "\\%c", c);
+		} else if (c < 0x20) {
+			fprintf(stream, "\\u%04x", c);
+		} else {
+			fputc(c, stream);
+		}
+	}
+	fputc('"', stream);
+}
+
+/* Starts recording, allocating the rings lazily on the first event of each kernel thread */
+int uthread_trace_start(size_t events) {
+	if (events == 0) {
+		return -1;
+	}
+	if (capacity == 0) {
+		capacity = 1;
+		while (capacity < events) {
+			capacity <<= 1;
+		}
+		epoch_cycles = timer_cycles();
+		epoch_ns = timer_now();
+		// Threads simply go unnamed in the trace if this fails
+		names = calloc(capacity, sizeof(*names));
+	}
+	atomic_store(&trace_enabled, true);
+	return 0;
+}
+
+/* Stops recording, keeping the events */
+void uthread_trace_stop(void) {
+	atomic_store(&trace_enabled, false);
+}
+
+/* Names of the instant events, indexed by type */
+static const char *const event_names[] = {
+	[TRACE_CREATE] = "create",
+	[TRACE_EXIT] = "exit",
+	[TRACE_BLOCK] = "block",
+	[TRACE_UNBLOCK] = "unblock",
+	[TRACE_PREEMPT] = "preempt",
+	[TRACE_SEM_DOWN] = "sem_down",
+	[TRACE_SEM_UP] = "sem_up",
+};
+
+/* Starts a JSON event, after the separator from the previous one */
+static void json_begin(FILE *stream, bool *first) {
+	if (!*first) {
+		fputs(",\n", stream);
+	}
+	*first = false;
+}
+
+/* Writes one event, as JSON events on the track of its thread */
+static void event_dump(FILE *stream, const struct trace_event *event, unsigned int worker,
+		       double ns_per_cycle, bool *first) {
+	double ts = (event->time - epoch_cycles) * ns_per_cycle / 1000;
+
+	switch (event->type) {
+	case TRACE_SWITCH:
+		// Running slices of the threads, the idle loop (0) being left out
+		if (event->thread != 0) {
+			json_begin(stream, first);
+			fprintf(stream, "{\"name\":\"running\",\"ph\":\"E\",\"pid\":0,\"tid\":%" PRIu32
+				",\"ts\":%.3f}", event->thread, ts);
+		}
+		if (event->arg != 0) {
+			json_begin(stream, first);
+			fprintf(stream, "{\"name\":\"running\",\"ph\":\"B\",\"pid\":0,\"tid\":%" PRIu64
+				",\"ts\":%.3f,\"args\":{\"worker\":%u}}", event->arg, ts, worker);
+		}
+		break;
+	case TRACE_CREATE:
+		json_begin(stream, first);
+		fprintf(stream, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%" PRIu32
+			",\"args\":{\"name\":", event->thread);
+		if (thread_name(event->thread) != NULL) {
+			json_string(stream, thread_name(event->thread));
+		} else {
+			fprintf(stream, "\"uthread %" PRIu32 "\"", event->thread);
+		}
+		fputs("}}", stream);
+		// Fall through
+	case TRACE_UNBLOCK:
+		json_begin(stream, first);
+		fprintf(stream, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":%" PRIu32
+			",\"ts\":%.3f,\"args\":{\"worker\":%u,\"by\":%" PRIu64 "}}",
+			event_names[event->type], event->thread, ts, worker, event->arg);
+		break;
+	case TRACE_SEM_DOWN:
+	case TRACE_SEM_UP:
+		json_begin(stream, first);
+		fprintf(stream, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":%" PRIu32
+			",\"ts\":%.3f,\"args\":{\"worker\":%u,\"sem\":\"0x%" PRIx64 "\"}}",
+			event_names[event->type], event->thread, ts, worker, event->arg);
+		break;
+	default:
+		json_begin(stream, first);
+		fprintf(stream, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"pid\":0,\"tid\":%" PRIu32
+			",\"ts\":%.3f,\"args\":{\"worker\":%u}}",
+			event_names[event->type], event->thread, ts, worker);
+		break;
+	}
+}
+
+/* Converts the events of all the rings into Chrome trace JSON */
+int uthread_trace_dump(FILE *stream) {
+	uint64_t cycles = timer_cycles() - epoch_cycles;
+	double ns_per_cycle = 1;
+	bool first = true;
+	int count = 0;
+
+	if (stream == NULL) {
+		return -1;
+	}
+	if (cycles != 0) {
+		ns_per_cycle = (double)(timer_now() - epoch_ns) / cycles;
+	}
+
+	fprintf(stream, "{\"traceEvents\":[\n");
+	for (struct trace_ring *r = atomic_load(&rings); r != NULL; r = r->next) {
+		// Only the last @capacity events are left in a ring that wrapped around
+		uint64_t start = r->head > capacity ? r->head - capacity : 0;
+
+		for (uint64_t i = start; i < r->head; i++) {
+			event_dump(stream, &r->events[i & (capacity - 1)], r->index, ns_per_cycle, &first);
+			count++;
+		}
+	}
+	fprintf(stream, "\n],\"displayTimeUnit\":\"ns\"}\n");
+
+	return count;
+}
+
+/* Releases the rings, once nothing records events anymore */
+void uthread_trace_clear(void) {
+	struct trace_ring *r = atomic_exchange(&rings, NULL);
+
+	while (r != NULL) {
+		struct trace_ring *next = r->next;
+
+		munmap(r, r->size);
+		r = next;
+	}
+	free(names);
+	names = NULL;
+	atomic_store(&nr_rings, 0);
+	atomic_fetch_add(&generation, 1);
+	capacity = 0;
+}
@@ -0,0 +1,64 @@
+#ifndef _UTHREAD_TRACE_H
+#define _UTHREAD_TRACE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Event tracing
+ *
+ * While tracing is on, the library records scheduling events into binary ring
+ * buffers, one per kernel thread, each event with a timestamp: context
+ * switches, thread creations and exits, blocking and unblocking, preemption
+ * ticks, and semaphore downs and ups. Recording takes no lock, and costs a
+ * single branch while tracing is off.
+ *
+ * The rings are then dumped as Chrome trace JSON, which chrome://tracing and
+ * Perfetto show as one timeline per thread.
+ */
+
+/*
+ * uthread_trace_start - Start recording events
+ * @capacity: Number of events each ring holds, rounded up to a power of two
+ *
+ * Can be called before uthread_run() as well as from a running thread. Once a
+ * ring is full, its oldest events are overwritten. @capacity only applies to
+ * the first call after uthread_trace_clear(), later calls resume recording
+ * into the existing rings.
+ *
+ * Return: -1 if @capacity is 0, 0 otherwise.
+ */
+int uthread_trace_start(size_t capacity);
+
+/*
+ * uthread_trace_stop - Stop recording events
+ *
+ * The events recorded so far are kept until uthread_trace_clear().
+ */
+void uthread_trace_stop(void);
+
+/*
+ * uthread_trace_dump - Write the recorded events as Chrome trace JSON
+ * @stream: Stream to write to
+ *
+ * Each thread gets its own track, labelled with its name (see struct
+ * uthread_attr), or with its number in creation order if it has none, on which
+ * it appears as running between the context switches to and from it,
+ * and on which its other events appear as instants. Thread numbers start over
+ * at each uthread_run(), so a trace is best dumped for a single run.
+ *
+ * Meant to be called once tracing is stopped.
+ *
+ * Return: Number of events written, or -1 if @stream is NULL.
+ */
+int uthread_trace_dump(FILE *stream);
+
+/*
+ * uthread_trace_clear - Discard the recorded events
+ *
+ * Release the rings. Must be called with tracing stopped, and outside of
+ * uthread_run().
+ */
+void uthread_trace_clear(void);
+
+#endif /* _UTHREAD_TRACE_H */
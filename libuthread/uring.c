@@ -0,0 +1,297 @@
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "io.h"
+#include "private.h"
+
+/* Number of submission queue entries, the completion queue gets twice as many */
+#define RING_ENTRIES 256
+
+/* File I/O request of a blocked thread, lives on its stack */
+struct uring_request {
+	struct uthread_tcb *uthread;
+	int res;
+};
+
+/* Submission queue, shared with the kernel */
+struct uring_sq {
+	uint32_t _Atomic *head;
+	uint32_t _Atomic *tail;
+	uint32_t mask;
+	uint32_t entries;
+	uint32_t *array;
+	struct io_uring_sqe *sqes;
+	void *ring;
+	size_t ring_size;
+};
+
+/* Completion queue, shared with the kernel */
+struct uring_cq {
+	uint32_t _Atomic *head;
+	uint32_t _Atomic *tail;
+	uint32_t mask;
+	uint32_t entries;
+	struct io_uring_cqe *cqes;
+	void *ring;
+	size_t ring_size;
+};
+
+static int ring_fd = -1;
+static struct uring_sq sq;
+static struct uring_cq cq;
+
+// Protects both queues against the other workers
+static uthread_spinlock_t ring_lock;
+// Requests queued but not yet submitted to the kernel
+static atomic_uint unsubmitted;
+// Requests submitted, or about to be, whose thread waits for completion
+static atomic_uint in_flight;
+
+/* Sets up the ring, ring_fd stays -1 if io_uring is unavailable */
+int uring_start(void) {
+	struct io_uring_params params;
+	void *sqes;
+
+	memset(&params, 0, sizeof(params));
+	ring_fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+	if (ring_fd < 0) {
+		return -1;
+	}
+
+	sq.ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	cq.ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	// Recent kernels map both queues at once
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (cq.ring_size > sq.ring_size) {
+			sq.ring_size = cq.ring_size;
+		}
+		cq.ring_size = sq.ring_size;
+	}
+
+	sq.ring = mmap(NULL, sq.ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+		       ring_fd, IORING_OFF_SQ_RING);
+	if (sq.ring == MAP_FAILED) {
+		goto err_close;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		cq.ring = sq.ring;
+	} else {
+		cq.ring = mmap(NULL, cq.ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			       ring_fd, IORING_OFF_CQ_RING);
+		if (cq.ring == MAP_FAILED) {
+			goto err_sq;
+		}
+	}
+	sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+		    MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED) {
+		goto err_cq;
+	}
+
+	sq.head = (uint32_t _Atomic *)((char *)sq.ring + params.sq_off.head);
+	sq.tail = (uint32_t _Atomic *)((char *)sq.ring + params.sq_off.tail);
+	sq.mask = *(uint32_t *)((char *)sq.ring + params.sq_off.ring_mask);
+	sq.entries = params.sq_entries;
+	sq.array = (uint32_t *)((char *)sq.ring + params.sq_off.array);
+	sq.sqes = sqes;
+
+	cq.head = (uint32_t _Atomic *)((char *)cq.ring + params.cq_off.head);
+	cq.tail = (uint32_t _Atomic *)((char *)cq.ring + params.cq_off.tail);
+	cq.mask = *(uint32_t *)((char *)cq.ring + params.cq_off.ring_mask);
+	cq.entries = params.cq_entries;
+	cq.cqes = (struct io_uring_cqe *)((char *)cq.ring + params.cq_off.cqes);
+
+	uthread_spin_init(&ring_lock);
+	atomic_store(&unsubmitted, 0);
+	atomic_store(&in_flight, 0);
+	return 0;
+
+err_cq:
+	if (cq.ring != sq.ring) {
+		munmap(cq.ring, cq.ring_size);
+	}
+err_sq:
+	munmap(sq.ring, sq.ring_size);
+err_close:
+	close(ring_fd);
+	ring_fd = -1;
+	return -1;
+}
+
+/* Tears the ring down, no request may be in flight anymore */
+void uring_stop(void) {
+	if (ring_fd < 0) {
+		return;
+	}
+	munmap(sq.sqes, sq.entries * sizeof(struct io_uring_sqe));
+	if (cq.ring != sq.ring) {
+		munmap(cq.ring, cq.ring_size);
+	}
+	munmap(sq.ring, sq.ring_size);
+	close(ring_fd);
+	ring_fd = -1;
+}
+
+/* Returns the ring fd, readable when completions are available; -1 without io_uring */
+int uring_fd(void) {
+	return ring_fd;
+}
+
+/* Returns true if some thread waits for a file I/O completion */
+bool uring_pending(void) {
+	return atomic_load(&in_flight) > 0;
+}
+
+/* Hands the queued requests over to the kernel, with the ring locked */
+static void submit_locked(void) {
+	unsigned int count = atomic_load(&unsubmitted);
+
+	while (count > 0) {
+		int ret = syscall(__NR_io_uring_enter, ring_fd, count, 0, 0, NULL, 0);
+
+		if (ret <= 0) {
+			// Interrupted or short of resources, try again on the next poll
+			return;
+		}
+		count -= ret;
+		atomic_fetch_sub(&unsubmitted, ret);
+	}
+}
+
+/* Submits the queued requests and unblocks the threads whose request completed */
+int uring_poll(void) {
+	struct uthread_list woken;
+	struct uthread_tcb *uthread;
+	uint32_t head, tail;
+	int count = 0;
+
+	if (atomic_load(&in_flight) == 0) {
+		return 0;
+	}
+
+	uthread_list_init(&woken);
+	uthread_spin_lock(&ring_lock);
+	if (atomic_load(&unsubmitted) > 0) {
+		submit_locked();
+	}
+
+	// Collects completions; their threads are blocked, so their TCB is free to be linked
+	head = atomic_load_explicit(cq.head, memory_order_relaxed);
+	tail = atomic_load_explicit(cq.tail, memory_order_acquire);
+	for (; head != tail; head++) {
+		struct io_uring_cqe *cqe = &cq.cqes[head & cq.mask];
+		struct uring_request *request = (struct uring_request *)(uintptr_t)cqe->user_data;
+
+		request->res = cqe->res;
+		uthread_list_push(&woken, request->uthread);
+	}
+	atomic_store_explicit(cq.head, head, memory_order_release);
+	uthread_spin_unlock(&ring_lock);
+
+	while ((uthread = uthread_list_pop(&woken)) != NULL) {
+		uthread_unblock(uthread);
+		atomic_fetch_sub(&in_flight, 1);
+		uthread_release();
+		count++;
+	}
+	return count;
+}
+
+/*
+ * Queues a request and blocks the calling thread until it completes. The
+ * request is only submitted to the kernel by the next poll, along with the
+ * requests of the other threads. Returns -1 if it cannot be queued.
+ */
+static int uring_submit(uint8_t opcode, int fd, const void *buf, size_t count, off_t offset,
+			int *res) {
+	struct uring_request request;
+	struct io_uring_sqe *sqe;
+	uint32_t tail;
+
+	if (ring_fd < 0 || uthread_current() == NULL || count > UINT32_MAX) {
+		return -1;
+	}
+
+	// Disable preemption while we change the queues
+	preempt_disable();
+	uthread_spin_lock(&ring_lock);
+
+	// Never have more requests in flight than the completion queue can hold
+	tail = atomic_load_explicit(sq.tail, memory_order_relaxed);
+	if (atomic_load(&in_flight) >= cq.entries ||
+	    tail - atomic_load_explicit(sq.head, memory_order_acquire) >= sq.entries) {
+		uthread_spin_unlock(&ring_lock);
+		preempt_enable();
+		return -1;
+	}
+
+	request.uthread = uthread_current();
+	sqe = &sq.sqes[tail & sq.mask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)buf;
+	sqe->len = count;
+	sqe->off = offset;
+	sqe->user_data = (uintptr_t)&request;
+	sq.array[tail & sq.mask] = tail & sq.mask;
+	atomic_store_explicit(sq.tail, tail + 1, memory_order_release);
+
+	atomic_fetch_add(&unsubmitted, 1);
+	// Held before no longer being runnable, so that the scheduler keeps going
+	uthread_hold();
+	atomic_fetch_add(&in_flight, 1);
+	// The lock is only released once we have switched away
+	uthread_block(&ring_lock);
+
+	// Critical section complete, enable preemption
+	preempt_enable();
+	*res = request.res;
+	return 0;
+}
+
+/* Converts a completion result into the return convention of system calls */
+static ssize_t uring_result(int res) {
+	if (res < 0) {
+		errno = -res;
+		return -1;
+	}
+	return res;
+}
+
+/* Reads from a file at an offset, through io_uring if possible */
+ssize_t uthread_pread(int fd, void *buf, size_t count, off_t offset) {
+	int res;
+
+	if (uring_submit(IORING_OP_READ, fd, buf, count, offset, &res) < 0) {
+		return pread(fd, buf, count, offset);
+	}
+	return uring_result(res);
+}
+
+/* Writes to a file at an offset, through io_uring if possible */
+ssize_t uthread_pwrite(int fd, const void *buf, size_t count, off_t offset) {
+	int res;
+
+	if (uring_submit(IORING_OP_WRITE, fd, buf, count, offset, &res) < 0) {
+		return pwrite(fd, buf, count, offset);
+	}
+	return uring_result(res);
+}
+
+/* Flushes a file to disk, through io_uring if possible */
+int uthread_fsync(int fd) {
+	int res;
+
+	if (uring_submit(IORING_OP_FSYNC, fd, NULL, 0, 0, &res) < 0) {
+		return fsync(fd);
+	}
+	return uring_result(res);
+}
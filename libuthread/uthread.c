@@ -1,14 +1,19 @@
 #include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/time.h>
+#include <time.h>
 
 #include "private.h"
 #include "uthread.h"
-#include "queue.h"
 
 // Thread state variable
 enum thread_state {
@@ -18,224 +23,1328 @@ enum thread_state {
 	ZOMBIE
 };
 
-// Initializing ready_queue and zombie_queue
-static queue_t ready_queue;
-static queue_t zombie_queue;
+/* Scheduling counters of a thread, times in cycles of timer_cycles() */
+struct thread_counters {
+	unsigned long voluntary;
+	unsigned long involuntary;
+	uint64_t run;
+	uint64_t ready;
+	uint64_t blocked;
+};
+
+/*
+ * Counters of a worker: its own, and the sums of the counters of the threads
+ * it switched and unblocked. Only ever written by their worker, and kept on
+ * their own cache line so that workers do not contend on them.
+ */
+struct worker_counters {
+	struct uthread_worker_stats worker;
+	struct thread_counters threads;
+	unsigned long creates;
+	unsigned long exits;
+} __attribute__((aligned(64)));
 
 /* Struct that should hold context of a thread, info about its stack, info about its state. */
 struct uthread_tcb {
+	struct uthread_tcb *next;	// Links of the uthread_list the thread is on
+	struct uthread_tcb *prev;
 	void *stack;
+	size_t stack_size;
 	uthread_ctx_t context;
 	enum thread_state state;
+	unsigned long id;
+	enum uthread_priority priority;
+	char name[UTHREAD_NAME_MAX];
+	// Joining, protected by join_lock
+	uthread_spinlock_t join_lock;
+	bool detached;
+	bool exited;
+	struct uthread_tcb *joiner;
+	uthread_join_func_t func;
+	void *arg;
+	void *retval;
+	// Statistics, written by the worker changing the thread's state
+	struct thread_counters counters;
+	uint64_t stamp;	// Time of the last state change
+};
+
+/* Number of slots of a worker's run queue, a power of two */
+#define DEQUE_SIZE 256
+
+/* Number of threads in a row a worker takes from its run-next slot, before its run queue */
+#define RUN_NEXT_STREAK 16
+
+/*
+ * Run queue of a worker, a bounded Chase-Lev style deque. Only its owner
+ * pushes threads, at the bottom. Threads are taken from the top, by the owner
+ * as well as by other workers stealing work, which keeps the round-robin order
+ * and only requires a compare-and-swap on the top index. Threads that do not
+ * fit go to the shared overflow queue.
+ */
+struct deque {
+	atomic_uint top;
+	atomic_uint bottom;
+	struct uthread_tcb *_Atomic slots[DEQUE_SIZE];
 };
 
-static struct uthread_tcb *current_thread = NULL;
-static struct uthread_tcb *main_thread = NULL;
+/*
+ * Scheduler worker: a kernel thread running user-level threads. Its idle TCB
+ * holds the context of the worker's own scheduling loop, which runs whenever
+ * the worker has no ready thread.
+ */
+struct uthread_worker {
+	struct uthread_tcb *current;
+	struct uthread_tcb idle;
+	struct deque ready_queue;
+	// High-priority thread to run next, ahead of the run queue
+	struct uthread_tcb *_Atomic run_next;
+	unsigned int run_next_streak;
+	// Work left for whoever runs right after a context switch
+	struct uthread_tcb *switched_from;
+	uthread_spinlock_t *unlock;
+	unsigned int id;
+	pthread_t pthread;
+	struct worker_counters *stats;
+	unsigned int yields;
+	bool preempted;	// The running thread is being switched away by a timer tick
+};
+
+static struct uthread_worker *workers;
+static unsigned int nr_workers;
+
+// Ready threads that did not fit in their worker's run queue
+static uthread_spinlock_t overflow_lock;
+static struct uthread_list overflow_queue;
+static atomic_int overflow_length;
+
+// Idle workers sleep until some work shows up
+static pthread_mutex_t sleep_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wakeup = PTHREAD_COND_INITIALIZER;
+static atomic_uint nr_sleeping;
+
+// While threads wait for I/O or timers, one idle worker sleeps in io_poll() instead
+static bool polling;
+static atomic_bool poller_asleep;
+// Time until which the poller sleeps, 0 while it is still being computed
+static _Atomic uint64_t poller_deadline;
+
+/* Number of yields between two checks for I/O on a busy worker */
+#define IO_POLL_INTERVAL 64
+
+// Per-worker counters of the last run, kept until the next one starts
+static struct worker_counters *worker_stats;
+static unsigned int nr_worker_stats;
+// Start of the last run on both clocks, to convert cycles into nanoseconds
+static uint64_t stats_epoch_cycles;
+static uint64_t stats_epoch_ns;
+
+// Worker running on the calling kernel thread
+static __thread struct uthread_worker *self;
+
+// Number of threads ready, running or held; scheduling stops when it drops to 0
+static atomic_int runnable;
+
+// Identifier of the last thread created
+static atomic_ulong last_id;
+
+// Joinable threads that exited and wait to be joined
+static uthread_spinlock_t zombie_lock;
+static struct uthread_list zombie_queue;
+
+/* Initializes a spinlock as unlocked */
+void uthread_spin_init(uthread_spinlock_t *lock) {
+	atomic_init(&lock->locked, false);
+}
+
+/* Spins until the lock is taken, letting the lock holder run if it takes too long */
+void uthread_spin_lock(uthread_spinlock_t *lock) {
+	unsigned int spins = 0;
+
+	while (atomic_exchange_explicit(&lock->locked, true, memory_order_acquire)) {
+		while (atomic_load_explicit(&lock->locked, memory_order_relaxed)) {
+			if (++spins % 128 == 0) {
+				sched_yield();
+			}
+		}
+	}
+}
+
+/* Releases a spinlock */
+void uthread_spin_unlock(uthread_spinlock_t *lock) {
+	atomic_store_explicit(&lock->locked, false, memory_order_release);
+}
 
 // Simple struct that returns pointer to current_thread
 struct uthread_tcb *uthread_current(void) {
-	return current_thread;
+	return self ? self->current : NULL;
+}
+
+/* Initializes an empty thread list */
+void uthread_list_init(struct uthread_list *list) {
+	list->head = NULL;
+	list->tail = NULL;
+	list->length = 0;
+}
+
+/* Appends a thread at the tail of a list */
+void uthread_list_push(struct uthread_list *list, struct uthread_tcb *uthread) {
+	uthread->next = NULL;
+	uthread->prev = list->tail;
+	if (list->tail == NULL) {
+		list->head = uthread;
+	} else {
+		list->tail->next = uthread;
+	}
+	list->tail = uthread;
+	list->length++;
+}
+
+/* Removes a thread from the list it is on */
+void uthread_list_remove(struct uthread_list *list, struct uthread_tcb *uthread) {
+	if (uthread->prev == NULL) {
+		list->head = uthread->next;
+	} else {
+		uthread->prev->next = uthread->next;
+	}
+	if (uthread->next == NULL) {
+		list->tail = uthread->prev;
+	} else {
+		uthread->next->prev = uthread->prev;
+	}
+	uthread->next = NULL;
+	uthread->prev = NULL;
+	list->length--;
+}
+
+/* Appends all the threads of @from at the tail of a list, leaving @from empty */
+void uthread_list_splice(struct uthread_list *list, struct uthread_list *from) {
+	if (from->head == NULL) {
+		return;
+	}
+	if (list->tail == NULL) {
+		list->head = from->head;
+	} else {
+		list->tail->next = from->head;
+		from->head->prev = list->tail;
+	}
+	list->tail = from->tail;
+	list->length += from->length;
+	uthread_list_init(from);
+}
+
+/* Removes and returns the thread at the head of a list, NULL if empty */
+struct uthread_tcb *uthread_list_pop(struct uthread_list *list) {
+	struct uthread_tcb *uthread = list->head;
+
+	if (uthread != NULL) {
+		uthread_list_remove(list, uthread);
+	}
+	return uthread;
+}
+
+/* Initializes an empty wait queue */
+void uthread_wait_init(struct uthread_wait_queue *queue) {
+	queue->head = NULL;
+	queue->tail = NULL;
+}
+
+/* Initializes the waiter of the running thread, outside of any selection */
+void uthread_waiter_init(struct uthread_waiter *waiter, void *elem) {
+	waiter->next = NULL;
+	waiter->prev = NULL;
+	waiter->uthread = uthread_current();
+	waiter->select = NULL;
+	waiter->index = 0;
+	waiter->elem = elem;
+	waiter->count = 1;
+	waiter->done = false;
+	waiter->linked = false;
+}
+
+/* Appends a waiter at the tail of a queue */
+void uthread_wait_push(struct uthread_wait_queue *queue, struct uthread_waiter *waiter) {
+	waiter->next = NULL;
+	waiter->prev = queue->tail;
+	if (queue->tail == NULL) {
+		queue->head = waiter;
+	} else {
+		queue->tail->next = waiter;
+	}
+	queue->tail = waiter;
+	waiter->linked = true;
+}
+
+/* Removes a waiter from its queue, unless a waker already took it off */
+void uthread_wait_remove(struct uthread_wait_queue *queue, struct uthread_waiter *waiter) {
+	if (!waiter->linked) {
+		return;
+	}
+	if (waiter->prev == NULL) {
+		queue->head = waiter->next;
+	} else {
+		waiter->prev->next = waiter->next;
+	}
+	if (waiter->next == NULL) {
+		queue->tail = waiter->prev;
+	} else {
+		waiter->next->prev = waiter->prev;
+	}
+	waiter->next = NULL;
+	waiter->prev = NULL;
+	waiter->linked = false;
+}
+
+/* Wakes up one sleeping worker, if any, so that it can steal new work */
+static void worker_wake_one(void) {
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load(&nr_sleeping) > 0) {
+		pthread_mutex_lock(&sleep_lock);
+		pthread_cond_signal(&wakeup);
+		pthread_mutex_unlock(&sleep_lock);
+	} else if (atomic_load(&poller_asleep)) {
+		io_kick();
+	}
+}
+
+/* Pushes a thread at the bottom of a deque, only called by its owner; -1 if full */
+static int deque_push(struct deque *deque, struct uthread_tcb *uthread) {
+	unsigned int bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+	unsigned int top = atomic_load_explicit(&deque->top, memory_order_acquire);
+
+	if (bottom - top >= DEQUE_SIZE) {
+		return -1;
+	}
+	atomic_store_explicit(&deque->slots[bottom % DEQUE_SIZE], uthread, memory_order_relaxed);
+	atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_release);
+	return 0;
+}
+
+/* Takes the thread at the top of a deque, by its owner or a thief; NULL if empty */
+static struct uthread_tcb *deque_take(struct deque *deque) {
+	unsigned int top = atomic_load_explicit(&deque->top, memory_order_acquire);
+
+	while (1) {
+		unsigned int bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
+		struct uthread_tcb *uthread;
+
+		if ((int)(bottom - top) <= 0) {
+			return NULL;
+		}
+		uthread = atomic_load_explicit(&deque->slots[top % DEQUE_SIZE], memory_order_relaxed);
+		// The slot cannot be reused by the owner before top moves past it
+		if (atomic_compare_exchange_weak_explicit(&deque->top, &top, top + 1,
+							  memory_order_acq_rel,
+							  memory_order_acquire)) {
+			return uthread;
+		}
+	}
+}
+
+/* Returns true if a deque looks non-empty */
+static bool deque_busy(struct deque *deque) {
+	unsigned int top = atomic_load(&deque->top);
+	unsigned int bottom = atomic_load(&deque->bottom);
+
+	return (int)(bottom - top) > 0;
+}
+
+/* Appends a ready thread to the calling worker's run queue */
+static void ready_push(struct uthread_tcb *uthread) {
+	if (deque_push(&self->ready_queue, uthread) < 0) {
+		uthread_spin_lock(&overflow_lock);
+		uthread_list_push(&overflow_queue, uthread);
+		atomic_fetch_add(&overflow_length, 1);
+		uthread_spin_unlock(&overflow_lock);
+	}
+	worker_wake_one();
+}
+
+/*
+ * Queues a thread that was just created or unblocked. A high-priority thread
+ * takes the calling worker's run-next slot, bumping the thread that was there
+ * back to the run queue.
+ */
+static void ready_wake(struct uthread_tcb *uthread) {
+	if (uthread->priority == UTHREAD_PRIO_HIGH) {
+		uthread = atomic_exchange(&self->run_next, uthread);
+		if (uthread == NULL) {
+			worker_wake_one();
+			return;
+		}
+	}
+	ready_push(uthread);
+}
+
+/* Takes the thread in a worker's run-next slot, by its owner or a thief; NULL if empty */
+static struct uthread_tcb *run_next_take(struct uthread_worker *worker) {
+	if (atomic_load_explicit(&worker->run_next, memory_order_relaxed) == NULL) {
+		return NULL;
+	}
+	return atomic_exchange(&worker->run_next, NULL);
+}
+
+/* Takes a thread from the shared overflow queue, NULL if empty */
+static struct uthread_tcb *overflow_pop(void) {
+	struct uthread_tcb *uthread;
+
+	if (atomic_load(&overflow_length) == 0) {
+		return NULL;
+	}
+	uthread_spin_lock(&overflow_lock);
+	uthread = uthread_list_pop(&overflow_queue);
+	if (uthread != NULL) {
+		atomic_fetch_sub(&overflow_length, 1);
+	}
+	uthread_spin_unlock(&overflow_lock);
+	return uthread;
+}
+
+/*
+ * Takes the next thread to run on the calling worker: from its run-next slot
+ * and its own run queue first, then from the overflow queue, then by stealing
+ * from the other workers in turn. Returns NULL if no thread is ready anywhere.
+ */
+static struct uthread_tcb *ready_pop(void) {
+	struct uthread_tcb *uthread = NULL;
+
+	// The run-next slot goes first, unless it has kept the run queue waiting for too long
+	if (self->run_next_streak < RUN_NEXT_STREAK) {
+		uthread = run_next_take(self);
+	}
+	if (uthread != NULL) {
+		self->run_next_streak++;
+	} else {
+		self->run_next_streak = 0;
+		uthread = deque_take(&self->ready_queue);
+		if (uthread == NULL) {
+			uthread = run_next_take(self);
+		}
+	}
+
+	if (uthread == NULL) {
+		uthread = overflow_pop();
+	}
+	for (unsigned int i = 1; uthread == NULL && i < nr_workers; i++) {
+		struct uthread_worker *victim = &workers[(self->id + i) % nr_workers];
+
+		uthread = deque_take(&victim->ready_queue);
+		if (uthread == NULL) {
+			uthread = run_next_take(victim);
+		}
+		if (uthread != NULL) {
+			self->stats->worker.steals++;
+		}
+	}
+	return uthread;
+}
+
+/* Returns true if some ready thread is waiting in any run queue */
+static bool work_available(void) {
+	if (atomic_load(&overflow_length) > 0) {
+		return true;
+	}
+	for (unsigned int i = 0; i < nr_workers; i++) {
+		if (deque_busy(&workers[i].ready_queue) || atomic_load(&workers[i].run_next) != NULL) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Charges the time since a thread's last state change to its current state */
+static inline void stats_account(struct uthread_tcb *uthread, uint64_t now) {
+	uint64_t elapsed = now - uthread->stamp;
+	struct thread_counters *total = &self->stats->threads;
+
+	uthread->stamp = now;
+	switch (uthread->state) {
+	case RUNNING:
+		uthread->counters.run += elapsed;
+		total->run += elapsed;
+		break;
+	case READY:
+		uthread->counters.ready += elapsed;
+		total->ready += elapsed;
+		break;
+	case BLOCKED:
+		uthread->counters.blocked += elapsed;
+		total->blocked += elapsed;
+		break;
+	default:
+		break;
+	}
+}
+
+/* Marks one fewer thread as runnable, waking all the workers up when none are left */
+static void runnable_dec(void) {
+	if (atomic_fetch_sub(&runnable, 1) == 1) {
+		pthread_mutex_lock(&sleep_lock);
+		pthread_cond_broadcast(&wakeup);
+		pthread_mutex_unlock(&sleep_lock);
+		if (atomic_load(&poller_asleep)) {
+			io_kick();
+		}
+	}
+}
+
+/*
+ * Reclaims a thread that exited, now that nothing runs on its stack anymore. A
+ * detached thread is freed right away, a joinable one is handed over to its
+ * joiner, or kept as a zombie until it gets joined.
+ */
+static void zombie_reclaim(struct uthread_tcb *zombie) {
+	struct uthread_tcb *joiner;
+
+	// Returns the stack to the pool
+	uthread_ctx_destroy_stack(zombie->stack, zombie->stack_size);
+	zombie->stack = NULL;
+
+	uthread_spin_lock(&zombie->join_lock);
+	if (zombie->detached) {
+		uthread_spin_unlock(&zombie->join_lock);
+		free(zombie);
+	} else {
+		zombie->exited = true;
+		joiner = zombie->joiner;
+		if (joiner == NULL) {
+			uthread_spin_lock(&zombie_lock);
+			uthread_list_push(&zombie_queue, zombie);
+			uthread_spin_unlock(&zombie_lock);
+		}
+		uthread_spin_unlock(&zombie->join_lock);
+		if (joiner != NULL) {
+			uthread_unblock(joiner);
+		}
+	}
+
+	// Only now that its joiner is runnable, so that the workers keep going
+	runnable_dec();
+}
+
+/*
+ * Completes a context switch, once running on the new context: requeues or
+ * reclaims the thread we switched from, and releases the lock it asked for.
+ * Neither could be done before, as the thread was still running on its stack.
+ *
+ * Kept out of line so that the address of `self` is computed anew, as the
+ * resumed thread may now be running on another kernel thread.
+ */
+static __attribute__((noinline)) void switch_finish(void) {
+	struct uthread_tcb *prev = self->switched_from;
+	uthread_spinlock_t *unlock = self->unlock;
+
+	self->switched_from = NULL;
+	self->unlock = NULL;
+
+	if (prev != NULL && prev != &self->idle) {
+		if (prev->state == READY) {
+			ready_push(prev);
+		} else if (prev->state == ZOMBIE) {
+			zombie_reclaim(prev);
+		}
+	}
+	if (unlock != NULL) {
+		uthread_spin_unlock(unlock);
+	}
+
+	// Every dispatch expires the timers that are due
+	timer_expire();
+}
+
+/* Switches from the running thread to @next, preemption must be disabled */
+static void switch_to(struct uthread_tcb *next) {
+	struct uthread_tcb *prev = self->current;
+	unsigned int depth = preempt_save();
+	uint64_t now = timer_cycles();
+
+	// Accounting without locks, the threads are only ours until the switch completes
+	if (prev != &self->idle) {
+		uint64_t elapsed = now - prev->stamp;
+
+		prev->stamp = now;
+		prev->counters.run += elapsed;
+		self->stats->threads.run += elapsed;
+		if (self->preempted) {
+			prev->counters.involuntary++;
+			self->stats->threads.involuntary++;
+		} else {
+			prev->counters.voluntary++;
+			self->stats->threads.voluntary++;
+		}
+	}
+	self->preempted = false;
+	if (next != &self->idle) {
+		stats_account(next, now);
+	}
+	trace(TRACE_SWITCH, prev->id, next->id);
+
+	self->switched_from = prev;
+	self->current = next;
+	next->state = RUNNING;
+	uthread_ctx_switch(&prev->context, &next->context);
+
+	// Resumed, possibly by another worker
+	preempt_restore(depth);
+	switch_finish();
+}
+
+/*
+ * Elects the next thread to run on this worker. A running thread keeps running
+ * if nothing else is ready, otherwise the worker goes back to its idle loop.
+ */
+static void schedule(void) {
+	struct uthread_tcb *curr = self->current;
+	struct uthread_tcb *next = ready_pop();
+
+	if (next == NULL) {
+		if (curr->state == RUNNING) {
+			return; // Continue running current thread
+		}
+		next = &self->idle;
+	}
+	if (curr->state == RUNNING) {
+		curr->state = READY;
+	}
+	switch_to(next);
+}
+
+/* Finishes the switch into a thread running for the first time */
+void uthread_start(void) {
+	preempt_restore(1);
+	switch_finish();
+}
+
+/* Yields to the next thread marked as READY, on behalf of the thread or of a timer tick */
+static void thread_yield(bool preempted) {
+	// Nothing to yield from in a worker's idle loop (e.g. preempted while idle)
+	if (self == NULL || self->current == &self->idle) {
+		return;
+	}
+
+	// Disable preemption while we change thread states and queues
+	preempt_disable();
+	// Busy workers never run out of ready threads, so they check for I/O once in a while
+	if (io_pending() && ++self->yields % IO_POLL_INTERVAL == 0) {
+		io_poll(0);
+	} else {
+		// Submits the file I/O queued since the last yield in one go, and reaps completions
+		uring_poll();
+	}
+	self->preempted = preempted;
+	schedule();
+	// Critical section complete, enable preemption
+	preempt_enable();
 }
 
 /* Yields to the next thread marked as READY */
 void uthread_yield(void) {
-    struct uthread_tcb *curr = current_thread;
-    struct uthread_tcb *next;
-
-    // Disable preemption while we change thread states and queues
-    preempt_disable();
-    // Only re-queue if thread is RUNNING (not BLOCKED or ZOMBIE)
-    if (curr->state == RUNNING) {
-        curr->state = READY;
-        queue_enqueue(ready_queue, curr);
-    }
-    
-    // Initializes next thread, dequeues from the ready queue
-    if (queue_dequeue(ready_queue, (void**)&next) < 0) {
-        // If next thread is not READY, exit
-        if (curr->state == ZOMBIE || curr->state == BLOCKED) {
-            exit(0);  // Nothing else to run
-        }
-        // Critical section complete, enable preemption (specifically for this if case)
-        preempt_enable();
-        return; // Continue running current thread
-    }
-    // Changes state of next thread to running and moves it to current thread
-    next->state = RUNNING;
-    current_thread = next;
-    // Critical section complete, enable preemption
-    preempt_enable();
-    if (next != curr) {
-        uthread_ctx_switch(&curr->context, &next->context);
-    }
+	thread_yield(false);
+}
+
+/* Yields on a timer tick, counting an involuntary switch */
+void uthread_preempt(void) {
+	if (self != NULL) {
+		trace(TRACE_PREEMPT, self->current->id, 0);
+	}
+	thread_yield(true);
 }
 
 /* Exits from current thread and changes its state to ZOMBIE */
 void uthread_exit(void) {
-    // Gets current_thread and tracks it as exiting_thread, changes its state to ZOMBIE
-    struct uthread_tcb *exiting_thread = current_thread;
-    
-    // Initializes variable for next_thread to switch to
-    struct uthread_tcb *next_thread;
-    
-    // Disable preemption while we change thread states and queues
-    preempt_disable();
-    exiting_thread->state = ZOMBIE;
-
-    // Checks if zombie_queue is available and adds exiting_thread to it if its stack is not empty
-    if (zombie_queue && exiting_thread->stack != NULL) {
-        queue_enqueue(zombie_queue, exiting_thread);
-    }
-
-    if (queue_dequeue(ready_queue, (void**)&next_thread) < 0) {
-        exit(0);
-    }
-
-    // Sets state of next_thread to RUNNING and sets it to current_thread
-    next_thread->state = RUNNING;
-    current_thread = next_thread;
-    
-    // Critical section complete, enable preemption
-    preempt_enable();
-
-    // Sets context of current thread to context of the thread it is switching to
-    setcontext(&next_thread->context);
-    assert(0);
-}
-
-/* Creates a thread with a function for the thread to run (and args) */
-int uthread_create(uthread_func_t func, void *arg) {
+	// Disable preemption while we change thread states and queues
+	preempt_disable();
+	self->stats->exits++;
+	trace(TRACE_EXIT, self->current->id, 0);
+	self->current->state = ZOMBIE;
+
+	// The thread we switch to reclaims us, and stops counting us as runnable
+	schedule();
+	assert(0);
+}
+
+/* Runs the function of a joinable thread, keeping its return value for the joiner */
+static void joinable_main(void *arg) {
+	struct uthread_tcb *tcb = arg;
+
+	tcb->retval = tcb->func(tcb->arg);
+}
+
+/*
+ * Creates a thread with a function for the thread to run (and args), NULL on
+ * failure. A @join_func is run in place of @func, keeping its return value.
+ * The thread has the attributes @attr, or the default ones if NULL.
+ */
+static struct uthread_tcb *thread_create(const struct uthread_attr *attr, uthread_func_t func,
+					 uthread_join_func_t join_func, void *arg, bool detached) {
+	struct uthread_attr defaults;
+
+	if (attr == NULL) {
+		uthread_attr_init(&defaults);
+		attr = &defaults;
+	}
+
 	// Allocates memory for thread control block
 	struct uthread_tcb *tcb = malloc(sizeof(*tcb));
 	if (tcb == NULL) {
-		return -1;
+		return NULL;
+	}
+	tcb->stack_size = uthread_ctx_stack_size(attr->stack_size);
+	if (tcb->stack_size == 0) {
+		free(tcb);
+		return NULL;
+	}
+	tcb->priority = attr->priority;
+	tcb->name[0] = '\0';
+	if (attr->name != NULL) {
+		strncat(tcb->name, attr->name, UTHREAD_NAME_MAX - 1);
 	}
-	
+	uthread_spin_init(&tcb->join_lock);
+	tcb->detached = detached;
+	tcb->exited = false;
+	tcb->joiner = NULL;
+	tcb->retval = NULL;
+	tcb->counters = (struct thread_counters){ 0 };
+	if (join_func != NULL) {
+		tcb->func = join_func;
+		tcb->arg = arg;
+		func = joinable_main;
+		arg = tcb;
+	}
+
+	// Disable preemption while we change the stack pool, thread states and queues
+	preempt_disable();
+
 	// Allocates memory for thread stack
-	tcb->stack = uthread_ctx_alloc_stack();
+	tcb->stack = uthread_ctx_alloc_stack(tcb->stack_size);
 	if (tcb->stack == NULL) {
+		preempt_enable();
 		free(tcb); // If stack allocation fails, free memory allocated to TCB
-		return -1;
+		return NULL;
 	}
 
-	// Takes args (uthread_ctx_t *uctx, void *top_of_stack, uthread_func_t func, void *arg)
-	uthread_ctx_init(&tcb->context, tcb->stack, func, arg);
+	// Takes args (uthread_ctx_t *uctx, void *top_of_stack, size_t size, uthread_func_t func, void *arg)
+	uthread_ctx_init(&tcb->context, tcb->stack, tcb->stack_size, func, arg);
 	tcb->state = READY;
-	
-	// Stops if ready queue somehow wasn't initialized
-	if (ready_queue == NULL) {
+	tcb->stamp = timer_cycles();
+	tcb->id = atomic_fetch_add(&last_id, 1) + 1;
+	self->stats->creates++;
+	trace(TRACE_CREATE, tcb->id, self->current->id);
+	if (tcb->name[0] != '\0' && atomic_load_explicit(&trace_enabled, memory_order_relaxed)) {
+		trace_name(tcb->id, tcb->name);
+	}
+
+	// Queues new threads locally, idle workers steal them if need be
+	atomic_fetch_add(&runnable, 1);
+	ready_wake(tcb);
+
+	// Critical section complete, enable preemption
+	preempt_enable();
+
+	return tcb;
+}
+
+/* Creates a detached thread */
+int uthread_create(uthread_func_t func, void *arg) {
+	return thread_create(NULL, func, NULL, arg, true) != NULL ? 0 : -1;
+}
+
+/* Creates a thread that has to be joined */
+int uthread_create_joinable(uthread_t *tid, uthread_join_func_t func, void *arg) {
+	struct uthread_tcb *tcb = thread_create(NULL, NULL, func, arg, false);
+
+	if (tcb == NULL) {
 		return -1;
 	}
+	*tid = tcb;
+	return 0;
+}
+
+/* Sets the default thread attributes */
+void uthread_attr_init(struct uthread_attr *attr) {
+	attr->stack_size = 0;
+	attr->name = NULL;
+	attr->priority = UTHREAD_PRIO_NORMAL;
+}
+
+/* Creates a thread with attributes, joinable if its identifier is wanted */
+int uthread_create_attr(uthread_t *tid, const struct uthread_attr *attr,
+			uthread_join_func_t func, void *arg) {
+	struct uthread_tcb *tcb = thread_create(attr, NULL, func, arg, tid == NULL);
+
+	if (tcb == NULL) {
+		return -1;
+	}
+	if (tid != NULL) {
+		*tid = tcb;
+	}
+	return 0;
+}
+
+/* Returns the name of a thread, or of the current one */
+const char *uthread_name(uthread_t tid) {
+	if (tid == NULL) {
+		if (self == NULL || self->current == &self->idle) {
+			return NULL;
+		}
+		tid = self->current;
+	}
+	return tid->name;
+}
+
+/* Blocks until a joinable thread exits, then frees it */
+int uthread_join(uthread_t tid, void **retval) {
+	if (self == NULL || tid == self->current) {
+		return -1;
+	}
+
+	// Disable preemption while we change thread states and queues
+	preempt_disable();
+	uthread_spin_lock(&tid->join_lock);
+	if (tid->detached || tid->joiner != NULL) {
+		uthread_spin_unlock(&tid->join_lock);
+		preempt_enable();
+		return -1;
+	}
+	if (tid->exited) {
+		// Already a zombie, nobody else can reach it anymore
+		uthread_spin_lock(&zombie_lock);
+		uthread_list_remove(&zombie_queue, tid);
+		uthread_spin_unlock(&zombie_lock);
+		uthread_spin_unlock(&tid->join_lock);
+	} else {
+		// Woken up by the next thread to run after it exits, once it is reclaimed
+		tid->joiner = self->current;
+		uthread_block(&tid->join_lock);
+	}
+	// Critical section complete, enable preemption
+	preempt_enable();
 
-    // Disable preemption while we change thread states and queues
-    preempt_disable();
+	if (retval != NULL) {
+		*retval = tid->retval;
+	}
+	free(tid);
+	return 0;
+}
 
-	// Adds thread to ready queue, checks to make sure it succeeds and frees tcb on failure
-	if (queue_enqueue(ready_queue, tcb) < 0) {
-        free(tcb->stack);
-        free(tcb);
-        preempt_enable(); // Critical section complete, enable preemption (for specific if case)
-        return -1;
-    }
-    // Critical section complete, enable preemption
-    preempt_enable();
+/* Lets a joinable thread be freed as soon as it exits */
+int uthread_detach(uthread_t tid) {
+	bool exited;
 
+	preempt_disable();
+	uthread_spin_lock(&tid->join_lock);
+	if (tid->detached || tid->joiner != NULL) {
+		uthread_spin_unlock(&tid->join_lock);
+		preempt_enable();
+		return -1;
+	}
+	tid->detached = true;
+	exited = tid->exited;
+	if (exited) {
+		uthread_spin_lock(&zombie_lock);
+		uthread_list_remove(&zombie_queue, tid);
+		uthread_spin_unlock(&zombie_lock);
+	}
+	uthread_spin_unlock(&tid->join_lock);
+	preempt_enable();
+
+	if (exited) {
+		free(tid);
+	}
 	return 0;
 }
 
+/* Polls for I/O until the next timer deadline, or until kicked */
+static void worker_poll(void) {
+	uint64_t deadline;
+	uint64_t now;
+
+	atomic_store(&poller_deadline, 0);
+	if (!timer_next(&deadline)) {
+		atomic_store(&poller_deadline, UINT64_MAX);
+		io_poll(-1);
+		return;
+	}
+	atomic_store(&poller_deadline, deadline);
+	now = timer_now();
+	io_poll(deadline > now ? (int64_t)(deadline - now) : 0);
+}
+
+/*
+ * Sleeps until some thread is ready, or until nothing is runnable anymore. If
+ * threads are waiting for I/O or timers and no other worker polls for them,
+ * polls until some I/O completes or the next timer is due instead.
+ */
+static void worker_sleep(struct uthread_worker *worker) {
+	pthread_mutex_lock(&sleep_lock);
+	if ((io_pending() || timer_pending()) && !polling) {
+		polling = true;
+		pthread_mutex_unlock(&sleep_lock);
+
+		// Wakers kick the poller once it is marked asleep, so check for work afterwards
+		atomic_store(&poller_asleep, true);
+		if (atomic_load(&runnable) > 0 && !work_available()) {
+			worker->stats->worker.idles++;
+			worker_poll();
+		}
+		atomic_store(&poller_asleep, false);
+
+		pthread_mutex_lock(&sleep_lock);
+		polling = false;
+		pthread_mutex_unlock(&sleep_lock);
+		return;
+	}
+	atomic_fetch_add(&nr_sleeping, 1);
+	if (atomic_load(&runnable) > 0 && !work_available()) {
+		worker->stats->worker.idles++;
+		pthread_cond_wait(&wakeup, &sleep_lock);
+	}
+	atomic_fetch_sub(&nr_sleeping, 1);
+	pthread_mutex_unlock(&sleep_lock);
+}
+
+/* Scheduling loop of a worker, runs threads until none are runnable */
+static void worker_loop(struct uthread_worker *worker) {
+	self = worker;
+	worker->current = &worker->idle;
+
+	preempt_disable();
+	preempt_timer_start();
+	while (1) {
+		struct uthread_tcb *next = ready_pop();
+
+		if (next != NULL) {
+			switch_to(next);
+			continue;
+		}
+		// Out of ready threads, maybe some are done waiting for I/O or sleeping
+		if (io_pending() && io_poll(0) > 0) {
+			continue;
+		}
+		if (timer_expire() > 0) {
+			continue;
+		}
+		if (atomic_load(&runnable) == 0) {
+			break;
+		}
+		worker_sleep(worker);
+	}
+	preempt_timer_stop();
+	preempt_enable();
+
+	self = NULL;
+}
+
+/* Entry point of the additional worker kernel threads */
+static void *worker_main(void *arg) {
+	worker_loop(arg);
+	return NULL;
+}
+
 /* Creates first user thread */
+int uthread_run_workers(unsigned int nworkers, bool preempt, uthread_func_t func, void *arg) {
+	unsigned int started = 1;
+	int ret = 0;
+
+	if (nworkers == 0) {
+		return -1;
+	}
+
+	// Fills the stack pool up to its low watermark
+	if (uthread_ctx_pool_start() < 0) {
+		return -1;
+	}
+	if (io_start() < 0) {
+		uthread_ctx_pool_stop();
+		return -1;
+	}
+	timer_start();
+
+	// Initializes the workers, worker 0 being the calling thread
+	free(worker_stats);
+	nr_worker_stats = 0;
+	worker_stats = aligned_alloc(_Alignof(struct worker_counters), nworkers * sizeof(*worker_stats));
+	workers = calloc(nworkers, sizeof(*workers));
+	if (workers == NULL || worker_stats == NULL) {
+		free(workers);
+		io_stop();
+		uthread_ctx_pool_stop();
+		return -1;
+	}
+	nr_workers = nworkers;
+	memset(worker_stats, 0, nworkers * sizeof(*worker_stats));
+	nr_worker_stats = nworkers;
+	stats_epoch_cycles = timer_cycles();
+	stats_epoch_ns = timer_now();
+	atomic_store(&runnable, 0);
+	atomic_store(&nr_sleeping, 0);
+	atomic_store(&last_id, 0);
+	for (unsigned int i = 0; i < nworkers; i++) {
+		struct uthread_worker *worker = &workers[i];
+
+		atomic_init(&worker->ready_queue.top, 0);
+		atomic_init(&worker->ready_queue.bottom, 0);
+		worker->idle.stack = NULL;
+		worker->idle.state = RUNNING;
+		worker->current = &worker->idle;
+		worker->id = i;
+		worker->stats = &worker_stats[i];
+		worker->yields = 0;
+		worker->preempted = false;
+		atomic_init(&worker->run_next, NULL);
+		worker->run_next_streak = 0;
+	}
+	uthread_spin_init(&overflow_lock);
+	uthread_list_init(&overflow_queue);
+	atomic_store(&overflow_length, 0);
+	uthread_spin_init(&zombie_lock);
+	uthread_list_init(&zombie_queue);
+	self = &workers[0];
+
+	if (preempt) {
+		preempt_start(true);
+		printf("Preempting started\n");
+	}
+
+	// Creates first user thread and checks for failure
+	if (uthread_create(func, arg) < 0) {
+		ret = -1;
+		nworkers = 1;
+	}
+
+	// Starts the other workers, which run until no thread is runnable anymore
+	for (; started < nworkers; started++) {
+		if (pthread_create(&workers[started].pthread, NULL, worker_main, &workers[started])) {
+			ret = -1;
+			break;
+		}
+	}
+
+	// Running until there are no more ready threads
+	worker_loop(&workers[0]);
+
+	for (unsigned int i = 1; i < started; i++) {
+		pthread_join(workers[i].pthread, NULL);
+	}
+
+	// Stops preemption when all threads are done
+	if (preempt) {
+		preempt_stop();
+	}
+
+	// Frees the joinable threads nobody joined (their stack already went back to the pool)
+	struct uthread_tcb *zombie;
+	while ((zombie = uthread_list_pop(&zombie_queue)) != NULL) {
+		free(zombie);
+	}
+
+	free(workers);
+	workers = NULL;
+	nr_workers = 0;
+
+	io_stop();
+
+	// Releases the stacks still cached in the pool
+	uthread_ctx_pool_stop();
+
+	return ret;
+}
+
+/* Runs the library on the calling kernel thread only */
 int uthread_run(bool preempt, uthread_func_t func, void *arg) {
-    if (preempt) {
-        preempt_start(true);
-        printf("Preempting started\n");
-    }
-
-    // Creates ready and zombie queues
-    ready_queue  = queue_create();
-    zombie_queue = queue_create();
-
-    // Checks to see if either queue failed to create, returns -1 if so
-    if (!ready_queue || !zombie_queue) {
-        return -1;
-    }
-
-    // Allocates memory for current_thread
-    current_thread = malloc(sizeof(struct uthread_tcb));
-    
-    // Checks to see if current thread failed to create
-    if (current_thread == NULL) {
-        return -1;
-    }
-
-    // Initializes context of current_thread and gives it to main_thread
-    current_thread->stack = NULL;
-    getcontext(&current_thread->context);
-    main_thread = current_thread;
-
-    // Creates first user thread and checks for failure
-    if (uthread_create(func, arg) < 0) {
-        free(current_thread);
-        return -1;
-    }
-    
-    // Running until there are no more ready threads
-    while (queue_length(ready_queue) > 0) {
-        uthread_yield();
-    }
-
-    // Disable preemption while we change thread states and queues
-    preempt_disable();
-
-    // Iterate through zombie queue and free it and its stack
-    struct uthread_tcb *zombie;
-    while (queue_dequeue(zombie_queue, (void**)&zombie) == 0) {
-        // Avoids freeing main_thread if it has been added to zombie queue
-        if (zombie != main_thread) {
-            uthread_ctx_destroy_stack(zombie->stack);
-            free(zombie);
-        }
-    }
-
-    // Critical section complete, enable preemption
-    preempt_enable();
-
-    // Frees the main_thread and current_thread when all other threads are finished
-    free(main_thread);
-    main_thread = NULL;
-    current_thread = NULL;
-
-    // Destroys both ready and zombie queues when they are empty
-    queue_destroy(ready_queue);
-    queue_destroy(zombie_queue);
-
-    // Stops preemption when all threads are done
-    if (preempt) {
-        preempt_stop();
-    }
-
-    return 0;
-}
-
-/* Sets current thread's state to BLOCKED */
-void uthread_block(void) {
-    // Disable preemption while we change thread states and queues
-    preempt_disable();
-
-	struct uthread_tcb *curr = uthread_current();
-	curr->state = BLOCKED;
+	return uthread_run_workers(1, preempt, func, arg);
+}
 
-    // Critical section complete, enable preemption
-    preempt_enable();
+/* Sets current thread's state to BLOCKED and switches away, releasing @lock afterwards */
+void uthread_block(uthread_spinlock_t *lock) {
+	struct uthread_tcb *curr = self->current;
+
+	trace(TRACE_BLOCK, curr->id, 0);
+	curr->state = BLOCKED;
+	runnable_dec();
+	self->unlock = lock;
+	schedule();
 }
 
-/* Sets current thread's state to READY */
+/* Sets current thread's state to READY, on the waker's run queue */
 void uthread_unblock(struct uthread_tcb *uthread) {
-    // Disable preemption while we change thread states and queues
-    preempt_disable();
+	// Disable preemption while we change thread states and queues
+	preempt_disable();
 
+	stats_account(uthread, timer_cycles());
+	trace(TRACE_UNBLOCK, uthread->id, self->current->id);
 	uthread->state = READY;
-	queue_enqueue(ready_queue, uthread);
+	atomic_fetch_add(&runnable, 1);
+	ready_wake(uthread);
 
-    // Critical section complete, enable preemption
-    preempt_enable();
-}
\ No newline at end of file
+	// Critical section complete, enable preemption
+	preempt_enable();
+}
+
+/* Sets the state of a list of threads to READY, queuing them all at once */
+void uthread_unblock_all(struct uthread_list *list) {
+	int count = list->length;
+
+	if (count == 0) {
+		return;
+	}
+
+	// Disable preemption while we change thread states and queues
+	preempt_disable();
+
+	uint64_t now = timer_cycles();
+	for (struct uthread_tcb *uthread = list->head; uthread != NULL; uthread = uthread->next) {
+		stats_account(uthread, now);
+		trace(TRACE_UNBLOCK, uthread->id, self->current->id);
+		uthread->state = READY;
+	}
+	atomic_fetch_add(&runnable, count);
+
+	uthread_spin_lock(&overflow_lock);
+	uthread_list_splice(&overflow_queue, list);
+	atomic_fetch_add(&overflow_length, count);
+	uthread_spin_unlock(&overflow_lock);
+
+	// One worker per thread at most, the others keep sleeping
+	for (int i = 0; i < count && i < (int)nr_workers; i++) {
+		worker_wake_one();
+	}
+
+	// Critical section complete, enable preemption
+	preempt_enable();
+}
+
+/* Unblocks a thread and runs it in place of the current one, which becomes ready */
+void uthread_handoff(struct uthread_tcb *uthread) {
+	// Disable preemption while we change thread states and queues
+	preempt_disable();
+
+	if (self == NULL || self->current == &self->idle) {
+		uthread_unblock(uthread);
+	} else {
+		atomic_fetch_add(&runnable, 1);
+		trace(TRACE_UNBLOCK, uthread->id, self->current->id);
+		self->current->state = READY;
+		// We are queued once switched away, possibly for another worker to steal
+		switch_to(uthread);
+	}
+
+	// Critical section complete, enable preemption
+	preempt_enable();
+}
+
+/* Sleeping thread, unblocked by its timer */
+struct sleeper {
+	struct uthread_timer timer;
+	struct uthread_tcb *uthread;
+	uthread_spinlock_t lock;
+};
+
+/* Wakes a sleeping thread up once its deadline passed */
+static void sleeper_wake(struct uthread_timer *timer) {
+	struct sleeper *sleeper = (struct sleeper *)timer;
+
+	// Waits for the sleeper to have switched away
+	uthread_spin_lock(&sleeper->lock);
+	uthread_spin_unlock(&sleeper->lock);
+
+	uthread_unblock(sleeper->uthread);
+	uthread_release();
+}
+
+/* Arms a timer, making the poller wake up earlier if need be */
+int uthread_timer_add(struct uthread_timer *timer, uint64_t deadline) {
+	if (timer_add(timer, deadline) < 0) {
+		return -1;
+	}
+
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load(&poller_asleep)) {
+		uint64_t poll_deadline = atomic_load(&poller_deadline);
+
+		if (poll_deadline == 0 || deadline < poll_deadline) {
+			io_kick();
+		}
+	}
+	return 0;
+}
+
+/* Returns the creation number of a thread, 0 for none */
+unsigned long uthread_id(struct uthread_tcb *uthread) {
+	return uthread != NULL ? uthread->id : 0;
+}
+
+/* Returns the current time, on the clock of sleep deadlines */
+uint64_t uthread_clock_ns(void) {
+	return timer_now();
+}
+
+/* Blocks the current thread until @deadline */
+void uthread_sleep_until(uint64_t deadline) {
+	struct sleeper sleeper;
+
+	// Outside of the library, only the calling kernel thread sleeps
+	if (self == NULL) {
+		struct timespec ts = {
+			.tv_sec = deadline / 1000000000,
+			.tv_nsec = deadline % 1000000000,
+		};
+
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+		return;
+	}
+
+	// Disable preemption while we change thread states and timers
+	preempt_disable();
+	timer_init(&sleeper.timer, sleeper_wake);
+	sleeper.uthread = self->current;
+	uthread_spin_init(&sleeper.lock);
+	uthread_spin_lock(&sleeper.lock);
+	if (uthread_timer_add(&sleeper.timer, deadline) < 0) {
+		// Already past the deadline
+		uthread_spin_unlock(&sleeper.lock);
+		preempt_enable();
+		return;
+	}
+
+	// Held before no longer being runnable, so that the scheduler keeps going
+	uthread_hold();
+	// The lock is only released once we have switched away
+	uthread_block(&sleeper.lock);
+
+	// The timer may still be returning from sleeper_wake() on another worker
+	timer_cancel(&sleeper.timer);
+
+	// Critical section complete, enable preemption
+	preempt_enable();
+}
+
+/* Blocks the current thread for @ns nanoseconds */
+void uthread_sleep_ns(uint64_t ns) {
+	uthread_sleep_until(timer_now() + ns);
+}
+
+/* Keeps the scheduler running while the current thread waits for an event */
+void uthread_hold(void) {
+	atomic_fetch_add(&runnable, 1);
+}
+
+/* Releases a uthread_hold(), once the held thread has been unblocked */
+void uthread_release(void) {
+	runnable_dec();
+}
+
+/* Copies the counters of a worker, from the current or last run */
+int uthread_worker_stats(unsigned int worker, struct uthread_worker_stats *stats) {
+	if (stats == NULL || worker >= nr_worker_stats) {
+		return -1;
+	}
+	*stats = worker_stats[worker].worker;
+	return 0;
+}
+
+/* Returns how many nanoseconds a cycle of timer_cycles() lasted since the last run started */
+static double stats_ns_per_cycle(void) {
+	uint64_t cycles = timer_cycles() - stats_epoch_cycles;
+
+	if (cycles == 0) {
+		return 1;
+	}
+	return (double)(timer_now() - stats_epoch_ns) / cycles;
+}
+
+/* Converts the counters of a thread, or their sums, into statistics */
+static void thread_stats_fill(const struct thread_counters *counters, double ns_per_cycle,
+			      struct uthread_thread_stats *stats) {
+	stats->voluntary_switches = counters->voluntary;
+	stats->involuntary_switches = counters->involuntary;
+	stats->run_ns = counters->run * ns_per_cycle;
+	stats->ready_ns = counters->ready * ns_per_cycle;
+	stats->blocked_ns = counters->blocked * ns_per_cycle;
+}
+
+/* Sums the counters of all the workers, from the current or last run */
+int uthread_stats(struct uthread_stats *stats) {
+	struct thread_counters threads = { 0 };
+
+	if (stats == NULL) {
+		return -1;
+	}
+	stats->creates = 0;
+	stats->exits = 0;
+	// Read without locks, workers may be updating them meanwhile
+	for (unsigned int i = 0; i < nr_worker_stats; i++) {
+		stats->creates += worker_stats[i].creates;
+		stats->exits += worker_stats[i].exits;
+		threads.voluntary += worker_stats[i].threads.voluntary;
+		threads.involuntary += worker_stats[i].threads.involuntary;
+		threads.run += worker_stats[i].threads.run;
+		threads.ready += worker_stats[i].threads.ready;
+		threads.blocked += worker_stats[i].threads.blocked;
+	}
+	thread_stats_fill(&threads, stats_ns_per_cycle(), &stats->threads);
+	return 0;
+}
+
+/* Copies the counters of a thread, including the time spent in its current state so far */
+int uthread_thread_stats(uthread_t tid, struct uthread_thread_stats *stats) {
+	struct thread_counters counters;
+	uint64_t now;
+
+	if (stats == NULL) {
+		return -1;
+	}
+	if (tid == NULL) {
+		if (self == NULL || self->current == &self->idle) {
+			return -1;
+		}
+		tid = self->current;
+	}
+
+	// Disable preemption while we read the counters of the current thread
+	preempt_disable();
+	counters = tid->counters;
+	now = timer_cycles();
+	// The stamp may come from another worker's clock, slightly ahead of ours
+	if (now > tid->stamp) {
+		switch (tid->state) {
+		case RUNNING:
+			counters.run += now - tid->stamp;
+			break;
+		case READY:
+			counters.ready += now - tid->stamp;
+			break;
+		case BLOCKED:
+			counters.blocked += now - tid->stamp;
+			break;
+		default:
+			break;
+		}
+	}
+	// Critical section complete, enable preemption
+	preempt_enable();
+
+	thread_stats_fill(&counters, stats_ns_per_cycle(), stats);
+	return 0;
+}
+
+/* Prints the statistics of the current or last run */
+void uthread_stats_dump(FILE *stream) {
+	struct uthread_stack_pool_stats pool;
+	struct uthread_stats stats;
+
+	uthread_stats(&stats);
+	uthread_stack_pool_stats(&pool);
+
+	fprintf(stream, "threads: %lu created, %lu exited\n", stats.creates, stats.exits);
+	fprintf(stream, "switches: %lu voluntary, %lu involuntary\n",
+		stats.threads.voluntary_switches, stats.threads.involuntary_switches);
+	fprintf(stream, "time: %.3f ms running, %.3f ms ready, %.3f ms blocked\n",
+		stats.threads.run_ns / 1e6, stats.threads.ready_ns / 1e6,
+		stats.threads.blocked_ns / 1e6);
+	for (unsigned int i = 0; i < nr_worker_stats; i++) {
+		fprintf(stream, "worker %u: %lu steals, %lu idles\n", i,
+			worker_stats[i].worker.steals, worker_stats[i].worker.idles);
+	}
+	fprintf(stream, "stack pool: %lu hits, %lu misses, %zu cached\n",
+		pool.hits, pool.misses, pool.cached);
+}
@@ -2,6 +2,9 @@
 #define _UTHREAD_H
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 
 /*
  * uthread_func_t - Thread function type
@@ -9,6 +12,22 @@
  */
 typedef void (*uthread_func_t)(void *arg);
 
+/*
+ * uthread_join_func_t - Joinable thread function type
+ * @arg: Argument to be passed to the thread
+ *
+ * Return: Value handed over to the thread that joins it
+ */
+typedef void *(*uthread_join_func_t)(void *arg);
+
+/*
+ * uthread_t - Thread identifier
+ *
+ * Identifies a joinable thread, from its creation until it is joined or
+ * detached.
+ */
+typedef struct uthread_tcb *uthread_t;
+
 /*
  * uthread_run - Run the multithreading library
  * @preempt: Preemption enable
@@ -26,6 +45,107 @@ typedef void (*uthread_func_t)(void *arg);
  */
 int uthread_run(bool preempt, uthread_func_t func, void *arg);
 
+/*
+ * uthread_run_workers - Run the multithreading library on several kernel threads
+ * @workers: Number of kernel worker threads
+ * @preempt: Preemption enable
+ * @func: Function of the first thread to start
+ * @arg: Argument to be passed to the first thread
+ *
+ * Same as uthread_run(), but threads are run by @workers kernel threads (the
+ * calling thread being one of them), so that they can execute in parallel.
+ * Each worker has its own run queue, on which it puts the threads it creates
+ * or unblocks. A worker running out of ready threads steals them from the other
+ * workers' run queues.
+ *
+ * uthread_run() is equivalent to running a single worker.
+ *
+ * Return: 0 in case of success, -1 in case of failure (e.g., @workers is 0,
+ * memory allocation, kernel thread creation).
+ */
+int uthread_run_workers(unsigned int workers, bool preempt,
+			uthread_func_t func, void *arg);
+
+/*
+ * uthread_worker_stats - Worker statistics
+ * @steals: Number of threads taken from other workers' run queues
+ * @idles: Number of times the worker went to sleep for lack of ready threads
+ */
+struct uthread_worker_stats {
+	unsigned long steals;
+	unsigned long idles;
+};
+
+/*
+ * uthread_worker_stats - Get worker statistics
+ * @worker: Index of the worker, 0 being the thread that called uthread_run()
+ *	or uthread_run_workers()
+ * @stats: Structure to fill
+ *
+ * Counters are reset each time the library starts, and remain readable after
+ * it returns.
+ *
+ * Return: -1 if @stats is NULL or if @worker does not exist, 0 otherwise.
+ */
+int uthread_worker_stats(unsigned int worker, struct uthread_worker_stats *stats);
+
+/*
+ * uthread_preempt_clock - Clock measuring the preemption quantum
+ * @UTHREAD_CLOCK_VIRTUAL: CPU time consumed by the worker
+ * @UTHREAD_CLOCK_PROF: CPU time consumed by the worker as well, user and
+ *	system time alike
+ * @UTHREAD_CLOCK_MONOTONIC: Elapsed wall-clock time, whether or not the worker
+ *	was running
+ *
+ * Each worker has its own timer, on a clock of its own: the quantum is the
+ * same whatever the number of workers. As per-thread CPU clocks count user and
+ * system time together, the virtual and profiling clocks behave the same.
+ */
+enum uthread_preempt_clock {
+	UTHREAD_CLOCK_VIRTUAL,
+	UTHREAD_CLOCK_PROF,
+	UTHREAD_CLOCK_MONOTONIC,
+};
+
+/*
+ * uthread_preempt_config - Configure preemption
+ * @clock: Clock measuring the quantum
+ * @quantum: Quantum in microseconds
+ *
+ * When preemption is enabled, every worker preempts its running thread each
+ * time @quantum elapses on @clock. Defaults to a 10 ms quantum of virtual time.
+ *
+ * The clock cannot be changed while preemption is running, only the quantum
+ * can (see uthread_preempt_quantum()).
+ *
+ * Return: -1 if @clock is invalid or cannot be changed, or if @quantum is 0,
+ * 0 otherwise.
+ */
+int uthread_preempt_config(enum uthread_preempt_clock clock,
+			   unsigned long quantum);
+
+/*
+ * uthread_preempt_quantum - Change the preemption quantum
+ * @quantum: Quantum in microseconds
+ *
+ * Can be called at any time, including by a running thread; the timers of the
+ * running workers are rearmed with the new quantum right away.
+ *
+ * Return: -1 if @quantum is 0, 0 otherwise.
+ */
+int uthread_preempt_quantum(unsigned long quantum);
+
+/*
+ * uthread_ctx_backend - Name of the context switch backend
+ *
+ * The library switches contexts with a small assembly routine on x86-64, or
+ * with swapcontext() when built with `make CTX=ucontext` (or for any other
+ * architecture).
+ *
+ * Return: "asm" or "ucontext", depending on the backend selected at build time
+ */
+const char *uthread_ctx_backend(void);
+
 /*
  * uthread_create - Create a new thread
  * @func: Function to be executed by the thread
@@ -34,11 +154,129 @@ int uthread_run(bool preempt, uthread_func_t func, void *arg);
  * This function creates a new thread running the function @func to which
  * argument @arg is passed.
  *
+ * The thread is detached: its stack and control block are reclaimed as soon as
+ * it exits.
+ *
  * Return: 0 in case of success, -1 in case of failure (e.g., memory allocation,
  * context creation).
  */
 int uthread_create(uthread_func_t func, void *arg);
 
+/*
+ * uthread_create_joinable - Create a new joinable thread
+ * @tid: Identifier of the new thread
+ * @func: Function to be executed by the thread
+ * @arg: Argument to be passed to the thread
+ *
+ * Same as uthread_create(), except that the thread has to be joined with
+ * uthread_join() (or detached with uthread_detach()), which gets the value
+ * returned by @func. Its stack is reclaimed as soon as it exits, but its
+ * control block is kept until then.
+ *
+ * Return: 0 in case of success, -1 in case of failure (e.g., memory allocation,
+ * context creation).
+ */
+int uthread_create_joinable(uthread_t *tid, uthread_join_func_t func, void *arg);
+
+/* Maximum length of a thread name, including the terminating null byte */
+#define UTHREAD_NAME_MAX 16
+
+/*
+ * uthread_priority - Scheduling priority hint
+ * @UTHREAD_PRIO_NORMAL: Queued behind the threads that are already ready
+ * @UTHREAD_PRIO_HIGH: Run next by the worker that creates or unblocks the
+ *	thread, ahead of the threads already ready on that worker
+ *
+ * Only a hint: high-priority threads that keep waking each other up still let
+ * the other ready threads run every now and then, and threads unblocked all at
+ * once (e.g., by uthread_cond_broadcast()) are queued in order regardless.
+ */
+enum uthread_priority {
+	UTHREAD_PRIO_NORMAL,
+	UTHREAD_PRIO_HIGH,
+};
+
+/*
+ * uthread_attr - Thread attributes
+ * @stack_size: Size of the thread's stack (in bytes), 0 for the default size
+ *	(see uthread_stack_config()). Rounded up to a power of two pages, at
+ *	least one page.
+ * @name: Name of the thread, for debugging, or NULL. Copied, and truncated to
+ *	UTHREAD_NAME_MAX - 1 characters.
+ * @priority: Scheduling priority hint
+ *
+ * Stacks of each size are recycled through the stack pool separately. A small
+ * stack is cheap, but the thread must then keep its call chain shallow, as
+ * overflowing its stack faults on the guard page below it. With preemption
+ * enabled, it must also leave room for the signal frames the timer ticks push
+ * on it (a few KiB).
+ */
+struct uthread_attr {
+	size_t stack_size;
+	const char *name;
+	enum uthread_priority priority;
+};
+
+/*
+ * uthread_attr_init - Initialize thread attributes to their defaults
+ * @attr: Attributes to initialize
+ *
+ * Default stack size, no name, and normal priority: threads created with these
+ * attributes are the same as the ones created by uthread_create().
+ */
+void uthread_attr_init(struct uthread_attr *attr);
+
+/*
+ * uthread_create_attr - Create a new thread with attributes
+ * @tid: Identifier of the new thread, or NULL
+ * @attr: Attributes of the new thread, or NULL for the defaults
+ * @func: Function to be executed by the thread
+ * @arg: Argument to be passed to the thread
+ *
+ * Same as uthread_create_joinable() if @tid is not NULL. Otherwise, the thread
+ * is detached as with uthread_create(), and the value returned by @func is
+ * discarded.
+ *
+ * Return: 0 in case of success, -1 in case of failure (e.g., memory allocation,
+ * context creation, stack size too large).
+ */
+int uthread_create_attr(uthread_t *tid, const struct uthread_attr *attr,
+			uthread_join_func_t func, void *arg);
+
+/*
+ * uthread_name - Get the name of a thread
+ * @tid: Identifier of the thread, or NULL for the calling thread
+ *
+ * Return: Name the thread was created with, "" if none, or NULL if @tid is NULL
+ * and called outside of a thread.
+ */
+const char *uthread_name(uthread_t tid);
+
+/*
+ * uthread_join - Wait for a thread to exit
+ * @tid: Identifier of the thread to join
+ * @retval: Value returned by the thread, or NULL
+ *
+ * Block the currently running thread until thread @tid exits, and reclaim it.
+ * A thread that finished with uthread_exit() returns NULL. Each thread can
+ * only be joined once, after which @tid is no longer valid.
+ *
+ * Return: -1 if @tid is the calling thread, was detached or is already being
+ * joined, or if called outside of uthread_run(), 0 otherwise.
+ */
+int uthread_join(uthread_t tid, void **retval);
+
+/*
+ * uthread_detach - Detach a thread
+ * @tid: Identifier of the thread to detach
+ *
+ * Let thread @tid be reclaimed as soon as it exits, instead of waiting to be
+ * joined. @tid is no longer valid afterwards.
+ *
+ * Return: -1 if @tid was already detached or is being joined, 0 otherwise.
+ */
+int uthread_detach(uthread_t tid);
+
 /*
  * uthread_yield - Yield execution
  *
@@ -51,10 +289,180 @@ void uthread_yield(void);
  * uthread_exit - Exit from currently running thread
  *
  * This function is to be called from the currently active and running thread in
- * order to finish its execution.
+ * order to finish its execution. Its stack is reclaimed by the next thread to
+ * run on its worker.
  *
  * This function shall never return.
  */
 void uthread_exit(void);
 
+/*
+ * uthread_clock_ns - Get the current time
+ *
+ * Return: Current time of the CLOCK_MONOTONIC clock, in nanoseconds
+ */
+uint64_t uthread_clock_ns(void);
+
+/*
+ * uthread_sleep_until - Sleep until a deadline
+ * @deadline: Time to wake up at, in nanoseconds on the clock of
+ *	uthread_clock_ns()
+ *
+ * Block the currently running thread until @deadline, letting other threads
+ * run meanwhile. Returns right away if @deadline already passed. The thread
+ * never wakes up early, but may wake up a little late: deadlines are rounded
+ * up to the resolution of the scheduler's timing wheel (about 65 us).
+ *
+ * When no thread is ready, the workers sleep until the next deadline.
+ *
+ * Called outside of uthread_run(), the calling kernel thread sleeps instead.
+ */
+void uthread_sleep_until(uint64_t deadline);
+
+/*
+ * uthread_sleep_ns - Sleep for a duration
+ * @ns: Duration to sleep for, in nanoseconds
+ *
+ * Same as uthread_sleep_until(uthread_clock_ns() + @ns).
+ */
+void uthread_sleep_ns(uint64_t ns);
+
+/*
+ * uthread_stack_mode - How thread stacks are mapped
+ * @UTHREAD_STACK_RESERVED: Stacks count in full against the system's commit
+ *	limit, and keep the memory they touched while cached in the stack pool
+ * @UTHREAD_STACK_LAZY: Stacks are mapped with MAP_NORESERVE, so that only the
+ *	pages they touch are ever committed, and all but their top 32 KiB are
+ *	given back (MADV_DONTNEED) when they return to the stack pool
+ *
+ * Either way, a page of a stack only takes physical memory once touched, and
+ * sits on top of a guard page.
+ */
+enum uthread_stack_mode {
+	UTHREAD_STACK_RESERVED,
+	UTHREAD_STACK_LAZY,
+};
+
+/*
+ * uthread_stack_config - Configure thread stacks
+ * @mode: How stacks are mapped
+ * @size: Size of the stacks of the threads created without a stack size of
+ *	their own (in bytes), 0 for 32 KiB
+ *
+ * Lazy stacks make large stacks cheap for threads that do not use them: e.g.,
+ * with a default size of 8 MiB, any thread can recurse deeply, while shallow
+ * threads still only take a page or two. Recycling a lazy stack larger than
+ * 32 KiB costs a system call, though.
+ *
+ * Must be called outside of uthread_run().
+ *
+ * Return: -1 if called from uthread_run(), or if @mode or @size is invalid, 0
+ * otherwise.
+ */
+int uthread_stack_config(enum uthread_stack_mode mode, size_t size);
+
+/*
+ * uthread_stack_pool_stats - Stack pool statistics
+ * @hits: Number of stack allocations served from the pool
+ * @misses: Number of stack allocations that had to map a new stack
+ * @cached: Number of stacks currently cached in the pool
+ */
+struct uthread_stack_pool_stats {
+	unsigned long hits;
+	unsigned long misses;
+	size_t cached;
+};
+
+/*
+ * uthread_stack_pool_config - Configure the stack pool
+ * @low: Low watermark
+ * @high: High watermark
+ *
+ * Thread stacks are recycled through a pool, which keeps stacks of different
+ * sizes apart. The pool is filled with @low stacks of the default size when
+ * uthread_run() starts, and whenever more than @high stacks of a given size are
+ * cached, those are trimmed back down to @low stacks.
+ *
+ * Return: -1 if @low is greater than @high, 0 otherwise.
+ */
+int uthread_stack_pool_config(size_t low, size_t high);
+
+/*
+ * uthread_stack_pool_stats - Get stack pool statistics
+ * @stats: Structure to fill
+ *
+ * Counters are reset each time uthread_run() starts, and remain readable after
+ * it returns.
+ */
+void uthread_stack_pool_stats(struct uthread_stack_pool_stats *stats);
+
+/*
+ * uthread_thread_stats - Thread scheduling statistics
+ * @voluntary_switches: Number of times the thread gave its worker up, by
+ *	yielding, blocking or exiting
+ * @involuntary_switches: Number of times the thread was preempted
+ * @run_ns: Time spent running
+ * @ready_ns: Time spent ready, waiting for a worker to run it
+ * @blocked_ns: Time spent blocked (on semaphores, mutexes, channels, sleeps,
+ *	joins or I/O)
+ */
+struct uthread_thread_stats {
+	unsigned long voluntary_switches;
+	unsigned long involuntary_switches;
+	uint64_t run_ns;
+	uint64_t ready_ns;
+	uint64_t blocked_ns;
+};
+
+/*
+ * uthread_stats - Scheduler statistics
+ * @creates: Number of threads created
+ * @exits: Number of threads that exited
+ * @threads: Sums of the statistics of all the threads, as of their last state
+ *	change
+ */
+struct uthread_stats {
+	unsigned long creates;
+	unsigned long exits;
+	struct uthread_thread_stats threads;
+};
+
+/*
+ * uthread_stats - Get scheduler statistics
+ * @stats: Structure to fill
+ *
+ * Take a snapshot of the scheduler counters. Counting is always on: each
+ * worker keeps its own counters without locking, timed with the CPU's cycle
+ * counter where available, and the snapshot sums them up. Taken while threads
+ * run on other workers, it may miss their latest updates.
+ *
+ * Counters are reset each time the library starts, and remain readable after
+ * it returns.
+ *
+ * Return: -1 if @stats is NULL, 0 otherwise.
+ */
+int uthread_stats(struct uthread_stats *stats);
+
+/*
+ * uthread_thread_stats - Get thread scheduling statistics
+ * @tid: Identifier of the thread, or NULL for the calling thread
+ * @stats: Structure to fill
+ *
+ * Statistics of a joinable thread remain readable after it exits, until it
+ * gets joined.
+ *
+ * Return: -1 if @stats is NULL, or if @tid is NULL and the caller is not a
+ * thread of the library. 0 otherwise.
+ */
+int uthread_thread_stats(uthread_t tid, struct uthread_thread_stats *stats);
+
+/*
+ * uthread_stats_dump - Print scheduler statistics
+ * @stream: Stream to print to
+ *
+ * Print the scheduler statistics, along with the worker and stack pool
+ * statistics, in a human-readable form.
+ */
+void uthread_stats_dump(FILE *stream);
+
 #endif /* _THREAD_H */